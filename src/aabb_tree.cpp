@@ -0,0 +1,72 @@
+#include "aabb_tree.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+static AabbTree::Box merged(AabbTree::Box const& a, AabbTree::Box const& b)
+{
+    return {
+        { std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y) },
+        { std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y) }
+    };
+}
+
+void AabbTree::build(Box const* boxes, int count)
+{
+    nodes.clear();
+    if (count <= 0)
+        return;
+
+    nodes.reserve(2 * count - 1);
+    items.resize(count);
+    std::iota(items.begin(), items.end(), 0);
+
+    centers.resize(count);
+    for (int i = 0; i < count; i++)
+        centers[i] = 0.5f * (boxes[i].min + boxes[i].max);
+
+    buildRange(boxes, 0, count);
+}
+
+// Splits items[begin, end) at the median along the longer side of their
+// centers' bounds; returns the index of the subtree's root
+int AabbTree::buildRange(Box const* boxes, int begin, int end)
+{
+    auto index { static_cast<int>(nodes.size()) };
+    nodes.emplace_back();
+
+    if (end - begin == 1) {
+        nodes[index].item = items[begin];
+        nodes[index].box = boxes[items[begin]];
+        return index;
+    }
+
+    sf::Vector2f low { centers[items[begin]] };
+    sf::Vector2f high { low };
+    for (auto i { begin + 1 }; i < end; i++) {
+        auto center { centers[items[i]] };
+        low = { std::min(low.x, center.x), std::min(low.y, center.y) };
+        high = { std::max(high.x, center.x), std::max(high.y, center.y) };
+    }
+
+    auto alongX { high.x - low.x >= high.y - low.y };
+    auto middle { begin + (end - begin) / 2 };
+    std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end, [&](int a, int b) {
+        return alongX ? centers[a].x < centers[b].x : centers[a].y < centers[b].y;
+    });
+
+    buildRange(boxes, begin, middle);
+    auto right { buildRange(boxes, middle, end) };
+
+    nodes[index].right = right;
+    nodes[index].box = merged(nodes[index + 1].box, nodes[right].box);
+    return index;
+}
+
+void AabbTree::refit(Box const* boxes)
+{
+    for (auto index { static_cast<int>(nodes.size()) - 1 }; index >= 0; index--) {
+        auto& node { nodes[index] };
+        node.box = node.right == -1 ? boxes[node.item] : merged(nodes[index + 1].box, nodes[node.right].box);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef AABB_TREE_HPP
+#define AABB_TREE_HPP
+
+#include "spatial_hash.hpp"
+
+#include <utility>
+#include <vector>
+
+// Bounding box hierarchy over a fixed set of items. The topology is built
+// once by median splits; after the items move, refit() recomputes the
+// boxes bottom-up in a single pass without changing the topology, which
+// stays good as long as the items keep roughly their arrangement (as the
+// boundary of a deforming body does).
+class AabbTree
+{
+public:
+    using Box = SpatialHash::Box;
+
+    void build(Box const* boxes, int count);
+    void refit(Box const* boxes);
+
+    bool empty() const { return nodes.empty(); }
+    Box const& bounds() const { return nodes.front().box; }
+
+    // Calls visit(item, otherItem) for every pair of overlapping leaves
+    template<typename Visit>
+    void query(AabbTree const& other, Visit&& visit) const
+    {
+        if (empty() || other.empty())
+            return;
+
+        traverse(other, false, visit);
+    }
+
+    // Calls visit(item, otherItem) once for every pair of distinct
+    // overlapping leaves of this tree
+    template<typename Visit>
+    void selfQuery(Visit&& visit) const
+    {
+        if (empty())
+            return;
+
+        traverse(*this, true, visit);
+    }
+
+private:
+    // Children of an inner node are the next node and right; leaves have
+    // right == -1 and hold an item. Parents come before their children,
+    // so refitting walks the nodes backwards.
+    struct Node
+    {
+        Box box{};
+        int right{ -1 };
+        int item{ -1 };
+    };
+
+    int buildRange(Box const* boxes, int begin, int end);
+
+    static bool overlaps(Box const& a, Box const& b)
+    {
+        return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+    }
+
+    // Descends both trees at once with an explicit stack, splitting the
+    // larger box first. Within one tree, a node paired with itself expands
+    // to its children's pairs, each unordered pair of leaves once.
+    template<typename Visit>
+    void traverse(AabbTree const& other, bool self, Visit& visit) const
+    {
+        auto& pending { stack };
+        pending.clear();
+        pending.emplace_back(0, 0);
+
+        while (!pending.empty()) {
+            auto [a, b] { pending.back() };
+            pending.pop_back();
+
+            auto const& nodeA { nodes[a] };
+            auto const& nodeB { other.nodes[b] };
+
+            if (self && a == b) {
+                if (nodeA.right != -1) {
+                    pending.emplace_back(a + 1, a + 1);
+                    pending.emplace_back(nodeA.right, nodeA.right);
+                    pending.emplace_back(a + 1, nodeA.right);
+                }
+                continue;
+            }
+
+            if (!overlaps(nodeA.box, nodeB.box))
+                continue;
+
+            auto leafA { nodeA.right == -1 };
+            auto leafB { nodeB.right == -1 };
+            if (leafA && leafB) {
+                visit(nodeA.item, nodeB.item);
+                continue;
+            }
+
+            auto splitA { leafB || (!leafA && area(nodeA.box) >= area(nodeB.box)) };
+            if (splitA) {
+                pending.emplace_back(a + 1, b);
+                pending.emplace_back(nodeA.right, b);
+            } else {
+                pending.emplace_back(a, b + 1);
+                pending.emplace_back(a, nodeB.right);
+            }
+        }
+    }
+
+    static float area(Box const& box) { return (box.max.x - box.min.x) * (box.max.y - box.min.y); }
+
+    std::vector<Node> nodes{};
+
+    // Build scratch: item order being partitioned and box centers
+    std::vector<int> items{};
+    std::vector<sf::Vector2f> centers{};
+
+    // Traversal stack, kept to avoid allocating on every query
+    mutable std::vector<std::pair<int, int>> stack{};
+};
+
+#endif // AABB_TREE_HPP
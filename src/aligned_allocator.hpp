@@ -0,0 +1,46 @@
+#ifndef ALIGNED_ALLOCATOR_HPP
+#define ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Minimal allocator handing out storage aligned to `Alignment` bytes, so
+// whole SIMD lanes counted from the start of a buffer never straddle a cache
+// line. The kernels still use unaligned loads, since they also run on
+// sub-ranges that start mid-lane.
+template<typename T, std::size_t Alignment>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t { Alignment }));
+    }
+
+    void deallocate(T* pointer, [[maybe_unused]] std::size_t count) noexcept
+    {
+        ::operator delete(pointer, std::align_val_t { Alignment });
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+};
+
+template<typename T, std::size_t Alignment>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
+
+#endif // ALIGNED_ALLOCATOR_HPP
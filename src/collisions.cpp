@@ -0,0 +1,607 @@
+#include "mesh_force_system.hpp"
+
+#include "tinyfiledialogs.h"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+static float dot(sf::Vector2f a, sf::Vector2f b)
+{
+    return a.x * b.x + a.y * b.y;
+}
+
+// Unit normal on the left of a -> b, which is the outside of static
+// geometry; zero for a degenerate side
+static sf::Vector2f outwardNormal(sf::Vector2f a, sf::Vector2f b)
+{
+    auto ab { b - a };
+    auto length { std::sqrt(dot(ab, ab)) };
+    return length > 1e-6f ? sf::Vector2f{ ab.y / length, -ab.x / length } : sf::Vector2f{};
+}
+
+// Side k runs from points[k] to the next point. Returns the side closest
+// to p and the closest point on it; inside is decided by the crossing rule.
+static std::size_t closestSide(std::vector<sf::Vector2f> const& points, sf::Vector2f p, bool& inside, sf::Vector2f& closest)
+{
+    inside = false;
+    std::size_t side { 0 };
+    float closestDistance { std::numeric_limits<float>::max() };
+
+    for (std::size_t k = 0; k < points.size(); k++) {
+        auto a { points[k] };
+        auto b { points[(k + 1) % points.size()] };
+        if ((a.y > p.y) != (b.y > p.y) && p.x < a.x + (p.y - a.y) / (b.y - a.y) * (b.x - a.x))
+            inside = !inside;
+
+        auto ab { b - a };
+        auto lengthSquared { dot(ab, ab) };
+        auto t { lengthSquared > 1e-12f ? std::clamp(dot(p - a, ab) / lengthSquared, 0.f, 1.f) : 0.f };
+        auto onSide { a + t * ab };
+        auto distance { dot(onSide - p, onSide - p) };
+        if (distance < closestDistance) {
+            closestDistance = distance;
+            closest = onSide;
+            side = k;
+        }
+    }
+
+    return side;
+}
+
+// Whether moving from -> to passes through the side a -> b from its outside;
+// t is how far along the move that happens
+static bool crossesSide(sf::Vector2f from, sf::Vector2f to, sf::Vector2f a, sf::Vector2f b, float& t)
+{
+    auto normal { outwardNormal(a, b) };
+    auto before { dot(from - a, normal) };
+    auto after { dot(to - a, normal) };
+    if (before < 0.f || after >= 0.f)
+        return false;
+
+    t = before / (before - after);
+    auto ab { b - a };
+    auto along { dot(from + t * (to - from) - a, ab) / dot(ab, ab) };
+    return along >= 0.f && along <= 1.f;
+}
+
+void MeshForceSystem::buildBoundary()
+{
+    // Every triangle side as (lower node, higher node, third corner);
+    // after sorting, sides that appear once are on the boundary
+    std::vector<std::tuple<int, int, int>> sides{};
+    sides.reserve(triangles.size() * 3);
+    for (auto const& tri : triangles) {
+        sides.emplace_back(std::min(tri.a, tri.b), std::max(tri.a, tri.b), tri.c);
+        sides.emplace_back(std::min(tri.b, tri.c), std::max(tri.b, tri.c), tri.a);
+        sides.emplace_back(std::min(tri.c, tri.a), std::max(tri.c, tri.a), tri.b);
+    }
+    std::sort(sides.begin(), sides.end());
+
+    boundaryEdges.clear();
+    for (std::size_t i = 0; i < sides.size();) {
+        auto j { i + 1 };
+        while (j < sides.size() && std::get<0>(sides[j]) == std::get<0>(sides[i]) && std::get<1>(sides[j]) == std::get<1>(sides[i]))
+            j++;
+
+        if (j - i == 1) {
+            auto [a, b, inside] { sides[i] };
+            if (Util::signedArea(restPositions[a], restPositions[b], restPositions[inside]) < 0.f)
+                std::swap(a, b);
+            boundaryEdges.push_back({ a, b, inside });
+        }
+        i = j;
+    }
+
+    boundaryNodes.clear();
+    for (auto const& edge : boundaryEdges)
+        boundaryNodes.insert(boundaryNodes.end(), { edge.a, edge.b });
+    std::sort(boundaryNodes.begin(), boundaryNodes.end());
+    boundaryNodes.erase(std::unique(boundaryNodes.begin(), boundaryNodes.end()), boundaryNodes.end());
+
+    auto slotOf = [&](int node) {
+        return std::lower_bound(boundaryNodes.begin(), boundaryNodes.end(), node) - boundaryNodes.begin();
+    };
+
+    boundaryNeighbors.assign(boundaryNodes.size(), { -1, -1 });
+    auto link = [&](int node, int neighbor) {
+        auto& neighbors { boundaryNeighbors[slotOf(node)] };
+        if (neighbors[0] == -1)
+            neighbors[0] = neighbor;
+        else if (neighbors[1] == -1)
+            neighbors[1] = neighbor;
+    };
+    for (auto& edge : boundaryEdges) {
+        link(edge.a, edge.b);
+        link(edge.b, edge.a);
+        edge.startSlot = static_cast<int>(slotOf(edge.a));
+    }
+
+    edgeBoxes.resize(boundaryEdges.size());
+
+    // Sides were sorted by their lower node, and bodies own contiguous
+    // node ranges, so each body's edges are already together
+    boundaryRanges.assign(bodies.size() + 1, 0);
+    for (auto const& edge : boundaryEdges)
+        boundaryRanges[bodyOf(edge.a) + 1]++;
+    for (std::size_t b = 0; b < bodies.size(); b++)
+        boundaryRanges[b + 1] += boundaryRanges[b];
+
+    // Tree topology comes from the rest shape and is only refit afterwards
+    for (std::size_t k = 0; k < boundaryEdges.size(); k++) {
+        auto const& edge { boundaryEdges[k] };
+        auto a { restPositions[edge.a] };
+        auto b { restPositions[edge.b] };
+        edgeBoxes[k] = { { std::min(a.x, b.x), std::min(a.y, b.y) }, { std::max(a.x, b.x), std::max(a.y, b.y) } };
+    }
+
+    boundaryTrees.resize(bodies.size());
+    for (std::size_t b = 0; b < bodies.size(); b++)
+        boundaryTrees[b].build(edgeBoxes.data() + boundaryRanges[b], boundaryRanges[b + 1] - boundaryRanges[b]);
+
+    collisionStatistics = {};
+}
+
+bool MeshForceSystem::resolveCollisions()
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto& statistics { collisionStatistics };
+    statistics.boundaryNodes = static_cast<int>(boundaryNodes.size());
+    statistics.boundaryEdges = static_cast<int>(boundaryEdges.size());
+    if (boundaryEdges.empty())
+        return false;
+
+    auto start { Clock::now() };
+
+    auto typicalBox { updateEdgeBoxes() };
+    candidates.clear();
+    if (broadPhase == BroadPhase::HashGrid)
+        findHashCandidates(typicalBox);
+    else
+        findTreeCandidates();
+    statistics.candidates += static_cast<int>(candidates.size());
+
+    auto broadPhaseEnd { Clock::now() };
+
+    bool moved { false };
+    for (auto const& candidate : candidates) {
+        if (resolveContact(boundaryNodes[candidate.slot], boundaryEdges[candidate.edge])) {
+            statistics.contacts++;
+            moved = true;
+        }
+    }
+
+    auto end { Clock::now() };
+    statistics.broadPhaseSeconds += std::chrono::duration<float>(broadPhaseEnd - start).count();
+    statistics.narrowPhaseSeconds += std::chrono::duration<float>(end - broadPhaseEnd).count();
+
+    return moved;
+}
+
+float MeshForceSystem::updateEdgeBoxes()
+{
+    float sum { 0.f };
+    for (std::size_t k = 0; k < boundaryEdges.size(); k++) {
+        auto const& edge { boundaryEdges[k] };
+        sf::Vector2f a { state.x(edge.a), state.y(edge.a) };
+        sf::Vector2f b { state.x(edge.b), state.y(edge.b) };
+        sf::Vector2f margin { collisionThickness, collisionThickness };
+
+        auto& box { edgeBoxes[k] };
+        box.min = sf::Vector2f{ std::min(a.x, b.x), std::min(a.y, b.y) } - margin;
+        box.max = sf::Vector2f{ std::max(a.x, b.x), std::max(a.y, b.y) } + margin;
+        sum += std::max(box.max.x - box.min.x, box.max.y - box.min.y);
+    }
+    return boundaryEdges.empty() ? 0.f : sum / boundaryEdges.size();
+}
+
+void MeshForceSystem::findHashCandidates(float cellSize)
+{
+    // Cells as large as a typical edge box keep most boxes within four
+    // cells. A stretched edge, such as one at a dragged node, is stored in
+    // every cell it spans instead of coarsening the grid for all bodies.
+    edgeHash.build(std::max(cellSize, collisionThickness), edgeBoxes);
+
+    for (std::size_t slot = 0; slot < boundaryNodes.size(); slot++) {
+        auto point { boundaryNodes[slot] };
+        edgeHash.query({ state.x(point), state.y(point) }, [&](int k) {
+            addCandidate(static_cast<int>(slot), k);
+        });
+    }
+}
+
+// Every body's tree against itself and against every later body's. Two
+// overlapping edge boxes may hold a contact between the start of either
+// edge and the other edge; since every boundary node starts an edge, no
+// node is missed.
+void MeshForceSystem::findTreeCandidates()
+{
+    for (std::size_t b = 0; b < boundaryTrees.size(); b++)
+        boundaryTrees[b].refit(edgeBoxes.data() + boundaryRanges[b]);
+
+    auto addPair = [&](int first, int second) {
+        addCandidate(boundaryEdges[first].startSlot, second);
+        addCandidate(boundaryEdges[second].startSlot, first);
+    };
+
+    for (std::size_t b = 0; b < boundaryTrees.size(); b++) {
+        auto offset { boundaryRanges[b] };
+        boundaryTrees[b].selfQuery([&](int i, int j) { addPair(offset + i, offset + j); });
+
+        for (auto other { b + 1 }; other < boundaryTrees.size(); other++) {
+            auto otherOffset { boundaryRanges[other] };
+            boundaryTrees[b].query(boundaryTrees[other], [&](int i, int j) { addPair(offset + i, otherOffset + j); });
+        }
+    }
+}
+
+void MeshForceSystem::addCandidate(int slot, int k)
+{
+    auto point { boundaryNodes[slot] };
+    auto const& neighbors { boundaryNeighbors[slot] };
+    auto const& edge { boundaryEdges[k] };
+    auto const& box { edgeBoxes[k] };
+
+    // Sides meeting at the node or next to it along the boundary always
+    // touch it
+    for (auto node : { point, neighbors[0], neighbors[1] }) {
+        if (edge.a == node || edge.b == node)
+            return;
+    }
+
+    sf::Vector2f position { state.x(point), state.y(point) };
+    if (position.x < box.min.x || position.x > box.max.x || position.y < box.min.y || position.y > box.max.y)
+        return;
+
+    candidates.push_back({ slot, k });
+}
+
+// Moves the node and the edge apart along the edge normal until they are
+// collisionThickness apart, weighted by inverse mass (pinned nodes do not
+// move), and removes the velocity with which they were approaching
+bool MeshForceSystem::resolveContact(int point, BoundaryEdge const& edge)
+{
+    if (point == edge.inside)
+        return false;
+
+    sf::Vector2f p { state.x(point), state.y(point) };
+    sf::Vector2f a { state.x(edge.a), state.y(edge.a) };
+    sf::Vector2f b { state.x(edge.b), state.y(edge.b) };
+    auto ab { b - a };
+
+    auto lengthSquared { dot(ab, ab) };
+    if (lengthSquared < 1e-12f)
+        return false;
+
+    // Beyond the ends of the edge the neighboring edges take over
+    auto t { dot(p - a, ab) / lengthSquared };
+    if (t <= 0.f || t >= 1.f)
+        return false;
+
+    auto length { std::sqrt(lengthSquared) };
+    sf::Vector2f normal { ab.y / length, -ab.x / length };
+    sf::Vector2f inside { state.x(edge.inside), state.y(edge.inside) };
+    if (dot(inside - a, normal) > 0.f)
+        normal = -normal;
+
+    auto separation { dot(p - a, normal) };
+    if (separation >= collisionThickness)
+        return false;
+
+    // Within one body, a node that was behind the edge at rest belongs
+    // there, however thin the part between them. Between bodies, deeper
+    // than half the edge the node is more likely past the far side of a
+    // thin part than pushed through this edge.
+    if (bodyOf(point) == bodyOf(edge.a)) {
+        auto const& restA { restPositions[edge.a] };
+        auto restAb { restPositions[edge.b] - restA };
+        sf::Vector2f restNormal { restAb.y, -restAb.x };
+        if (dot(restPositions[edge.inside] - restA, restNormal) > 0.f)
+            restNormal = -restNormal;
+        if (dot(restPositions[point] - restA, restNormal) < 0.f)
+            return false;
+    } else if (separation < -0.5f * length) {
+        return false;
+    }
+
+    auto wp { fixedMask[point] ? 0.f : 1.f };
+    auto wa { fixedMask[edge.a] ? 0.f : 1.f };
+    auto wb { fixedMask[edge.b] ? 0.f : 1.f };
+    auto weight { wp + wa * (1.f - t) * (1.f - t) + wb * t * t };
+    if (weight <= 0.f)
+        return false;
+
+    // Splits a change along the normal between the node and the ends of
+    // the edge, in proportion to how freely each of them moves
+    auto distribute = [&](float amount, float* xs, float* ys) {
+        auto push { amount / weight * normal };
+        xs[point] += wp * push.x;
+        ys[point] += wp * push.y;
+        xs[edge.a] -= wa * (1.f - t) * push.x;
+        ys[edge.a] -= wa * (1.f - t) * push.y;
+        xs[edge.b] -= wb * t * push.x;
+        ys[edge.b] -= wb * t * push.y;
+    };
+
+    distribute(collisionThickness - separation, state.xs(), state.ys());
+
+    sf::Vector2f pointVelocity { state.xDot(point), state.yDot(point) };
+    sf::Vector2f edgeVelocity {
+        (1.f - t) * state.xDot(edge.a) + t * state.xDot(edge.b),
+        (1.f - t) * state.yDot(edge.a) + t * state.yDot(edge.b)
+    };
+    auto approach { dot(pointVelocity - edgeVelocity, normal) };
+    if (approach < 0.f)
+        distribute(-approach, state.xDots(), state.yDots());
+
+    return true;
+}
+
+void MeshForceSystem::addLineCollider(sf::Vector2f a, sf::Vector2f b, float depth)
+{
+    addCollider({ { a, b }, false, depth });
+}
+
+void MeshForceSystem::addPolygonCollider(std::vector<sf::Vector2f> points)
+{
+    if (points.size() < 3)
+        return;
+
+    addCollider({ std::move(points), true, 0.f });
+}
+
+void MeshForceSystem::addCollider(StaticCollider collider)
+{
+    auto& bounds { collider.bounds };
+    bounds = { collider.points.front(), collider.points.front() };
+    for (auto point : collider.points) {
+        bounds.min = { std::min(bounds.min.x, point.x), std::min(bounds.min.y, point.y) };
+        bounds.max = { std::max(bounds.max.x, point.x), std::max(bounds.max.y, point.y) };
+    }
+
+    // A line reaches depth behind itself, whichever way it faces.
+    // Polygons are wound like lines, solid on the right of every side.
+    if (!collider.closed) {
+        sf::Vector2f margin { collider.depth, collider.depth };
+        bounds.min -= margin;
+        bounds.max += margin;
+    } else {
+        float twiceArea { 0.f };
+        for (std::size_t k = 0, previous = collider.points.size() - 1; k < collider.points.size(); previous = k++) {
+            auto a { collider.points[previous] };
+            auto b { collider.points[k] };
+            twiceArea += a.x * b.y - b.x * a.y;
+        }
+        if (twiceArea < 0.f)
+            std::reverse(collider.points.begin(), collider.points.end());
+    }
+
+    auto running { physicsThread.joinable() };
+    stop();
+    colliders.push_back(std::move(collider));
+    if (running)
+        startPhysics();
+}
+
+bool MeshForceSystem::loadObstacles(std::string const& filename)
+{
+    DistanceField field{};
+    if (!field.loadFromFile(filename) || !obstacleTexture.loadFromFile(filename))
+        return false;
+
+    auto running { physicsThread.joinable() };
+    stop();
+    obstacles = std::move(field);
+    showObstacles = true;
+    if (running)
+        startPhysics();
+    return true;
+}
+
+void MeshForceSystem::openFileDialogAndLoadObstacles()
+{
+    auto filename { tinyfd_openFileDialog(
+        "Select obstacle image",
+        NULL,   // No default path
+        0,      // Zero filter patterns
+        NULL,   // No filter pattern array
+        NULL,   // No filter description
+        0       // Don't allow multiple selects
+    ) };
+
+    if (filename && !loadObstacles(filename))
+        std::cout << "Obstacle images need an alpha channel" << std::endl;
+}
+
+bool MeshForceSystem::resolveStaticContacts(float h)
+{
+    auto& statistics { collisionStatistics };
+    bool moved { false };
+
+    auto contact = [&](int node, sf::Vector2f surface, sf::Vector2f normal) {
+        applyStaticContact(node, surface, normal, h);
+        statistics.staticContacts++;
+        moved = true;
+    };
+
+    for (int i = 0; i < state.size(); i++) {
+        if (fixedMask[i])
+            continue;
+
+        sf::Vector2f p { state.x(i), state.y(i) };
+
+        sf::Vector2f surface{};
+        sf::Vector2f normal{};
+        if (sweepStaticContact(stepStart[i], p, surface, normal)) {
+            contact(i, surface, normal);
+            statistics.sweptContacts++;
+            p = { state.x(i), state.y(i) };
+        }
+
+        // The ground is a half-plane
+        if (gravity && p.y > groundLevel)
+            contact(i, { p.x, groundLevel }, { 0.f, -1.f });
+
+        // Obstacles are one lookup, however complex they are
+        if (!obstacles.empty()) {
+            p = { state.x(i), state.y(i) };
+            auto distance { obstacles.distance(p) };
+            if (distance < 0.f) {
+                auto normal { obstacles.normal(p) };
+                if (normal != sf::Vector2f{})
+                    contact(i, p - distance * normal, normal);
+            }
+        }
+
+        for (auto const& collider : colliders) {
+            auto const& bounds { collider.bounds };
+            p = { state.x(i), state.y(i) };
+            if (p.x < bounds.min.x || p.x > bounds.max.x || p.y < bounds.min.y || p.y > bounds.max.y)
+                continue;
+
+            auto const& points { collider.points };
+
+            if (!collider.closed) {
+                auto a { points[0] };
+                auto ab { points[1] - a };
+                auto lengthSquared { dot(ab, ab) };
+                if (lengthSquared < 1e-12f)
+                    continue;
+
+                auto t { dot(p - a, ab) / lengthSquared };
+                auto normal { outwardNormal(a, points[1]) };
+                auto depth { -dot(p - a, normal) };
+                if (t >= 0.f && t <= 1.f && depth > 0.f && depth < collider.depth)
+                    contact(i, p + depth * normal, normal);
+                continue;
+            }
+
+            bool inside{};
+            sf::Vector2f closest{};
+            auto side { closestSide(points, p, inside, closest) };
+            if (inside)
+                contact(i, closest, outwardNormal(points[side], points[(side + 1) % points.size()]));
+        }
+    }
+
+    return moved;
+}
+
+bool MeshForceSystem::sweepStaticContact(sf::Vector2f from, sf::Vector2f to, sf::Vector2f& surface, sf::Vector2f& normal) const
+{
+    auto motion { to - from };
+    float earliest { 2.f };
+    bool missed { false };
+
+    auto consider = [&](float t, sf::Vector2f surfaceNormal, bool wouldMiss) {
+        if (t >= earliest)
+            return;
+        earliest = t;
+        surface = from + t * motion;
+        normal = surfaceNormal;
+        missed = wouldMiss;
+    };
+
+    SpatialHash::Box swept {
+        { std::min(from.x, to.x), std::min(from.y, to.y) },
+        { std::max(from.x, to.x), std::max(from.y, to.y) }
+    };
+
+    for (auto const& collider : colliders) {
+        auto const& bounds { collider.bounds };
+        if (swept.max.x < bounds.min.x || swept.min.x > bounds.max.x || swept.max.y < bounds.min.y || swept.min.y > bounds.max.y)
+            continue;
+
+        auto const& points { collider.points };
+        float t{};
+
+        if (!collider.closed) {
+            if (crossesSide(from, to, points[0], points[1], t)) {
+                auto ab { points[1] - points[0] };
+                auto along { dot(to - points[0], ab) / dot(ab, ab) };
+                auto sideNormal { outwardNormal(points[0], points[1]) };
+                auto depth { -dot(to - points[0], sideNormal) };
+                consider(t, sideNormal, along < 0.f || along > 1.f || depth >= collider.depth);
+            }
+            continue;
+        }
+
+        // The end position is pushed out through its closest side, which
+        // has to be the side it came in through
+        bool inside{};
+        sf::Vector2f closest{};
+        auto side { points.size() };
+
+        for (std::size_t k = 0; k < points.size(); k++) {
+            auto a { points[k] };
+            auto b { points[(k + 1) % points.size()] };
+            if (!crossesSide(from, to, a, b, t))
+                continue;
+
+            if (side == points.size())
+                side = closestSide(points, to, inside, closest);
+            consider(t, outwardNormal(a, b), !inside || side != k);
+        }
+    }
+
+    // Sphere tracing: no surface is closer to a point than its distance,
+    // so the march skips free space and only crawls near the obstacles
+    auto length { std::sqrt(dot(motion, motion)) };
+    auto distance { obstacles.empty() ? 0.f : obstacles.distance(from) };
+
+    if (distance > 0.f && distance < length) {
+        float travelled { 0.f };
+        while (travelled < length) {
+            auto next { std::min(travelled + std::max(distance, minimumMarch), length) };
+            auto nextDistance { obstacles.distance(from + next / length * motion) };
+
+            if (nextDistance < 0.f) {
+                auto hit { travelled + (next - travelled) * distance / (distance - nextDistance) };
+                auto hitNormal { obstacles.normal(from + hit / length * motion) };
+                auto endDistance { obstacles.distance(to) };
+                if (hitNormal != sf::Vector2f{})
+                    consider(hit / length, hitNormal, endDistance >= 0.f || dot(obstacles.normal(to), hitNormal) <= 0.f);
+                break;
+            }
+
+            travelled = next;
+            distance = nextDistance;
+        }
+    }
+
+    return earliest <= 1.f && missed;
+}
+
+void MeshForceSystem::applyStaticContact(int node, sf::Vector2f surface, sf::Vector2f normal, float h)
+{
+    state.x(node) = surface.x;
+    state.y(node) = surface.y;
+
+    sf::Vector2f velocity { state.xDot(node), state.yDot(node) };
+    auto normalSpeed { dot(velocity, normal) };
+    if (normalSpeed >= 0.f)
+        return;
+
+    auto tangent { velocity - normalSpeed * normal };
+    auto tangentSpeed { std::sqrt(dot(tangent, tangent)) };
+    auto bounce { -normalSpeed > bounceSpeed ? restitution : 0.f };
+    auto normalChange { -(1.f + bounce) * normalSpeed };
+    auto kept { tangentSpeed > 0.f ? std::max(0.f, 1.f - friction * normalChange / tangentSpeed) : 0.f };
+
+    velocity = -bounce * normalSpeed * normal + kept * tangent;
+    state.xDot(node) = velocity.x;
+    state.yDot(node) = velocity.y;
+
+    // The slide over the last step is taken back as far as friction
+    // stopped it; otherwise a node held by static friction would still
+    // creep by whatever the rest of the body dragged it along
+    auto held { -(1.f - kept) * h * tangent };
+    state.x(node) += held.x;
+    state.y(node) += held.y;
+}
@@ -0,0 +1,85 @@
+#include "distance_field.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+bool DistanceField::loadFromFile(std::string const& filename)
+{
+    cv::Mat img = cv::imread(filename, cv::IMREAD_UNCHANGED);
+
+    std::vector<cv::Mat> channels;
+    cv::split(img, channels);
+    if (channels.size() < 4 || img.cols < 2 || img.rows < 2)
+        return false;
+
+    cv::Mat solid;
+    cv::threshold(channels[3], solid, 10, 255, cv::THRESH_BINARY);
+    cv::Mat free;
+    cv::bitwise_not(solid, free);
+
+    // Each transform measures from every nonzero pixel to the nearest zero
+    // one: free pixels to the obstacles, and obstacle pixels to free space
+    cv::Mat outside;
+    cv::Mat inside;
+    cv::distanceTransform(free, outside, cv::DIST_L2, cv::DIST_MASK_PRECISE);
+    cv::distanceTransform(solid, inside, cv::DIST_L2, cv::DIST_MASK_PRECISE);
+
+    width = img.cols;
+    height = img.rows;
+    values.resize(static_cast<std::size_t>(width) * height);
+
+    // The surface lies halfway between the last obstacle pixel and the
+    // first free one
+    for (int y = 0; y < height; y++) {
+        auto const* out = outside.ptr<float>(y);
+        auto const* in = inside.ptr<float>(y);
+        for (int x = 0; x < width; x++)
+            values[static_cast<std::size_t>(y) * width + x] = in[x] > 0.f ? 0.5f - in[x] : out[x] - 0.5f;
+    }
+
+    return true;
+}
+
+float DistanceField::distance(sf::Vector2f point) const
+{
+    if (empty() || point.x < 0.f || point.y < 0.f || point.x > width - 1 || point.y > height - 1)
+        return std::numeric_limits<float>::max();
+
+    return interpolate(point);
+}
+
+float DistanceField::interpolate(sf::Vector2f point) const
+{
+    point.x = std::clamp(point.x, 0.f, static_cast<float>(width - 1));
+    point.y = std::clamp(point.y, 0.f, static_cast<float>(height - 1));
+
+    auto x0 { std::min(static_cast<int>(point.x), width - 2) };
+    auto y0 { std::min(static_cast<int>(point.y), height - 2) };
+    auto fx { point.x - x0 };
+    auto fy { point.y - y0 };
+
+    auto top { sample(x0, y0) + fx * (sample(x0 + 1, y0) - sample(x0, y0)) };
+    auto bottom { sample(x0, y0 + 1) + fx * (sample(x0 + 1, y0 + 1) - sample(x0, y0 + 1)) };
+    return top + fy * (bottom - top);
+}
+
+sf::Vector2f DistanceField::normal(sf::Vector2f point) const
+{
+    constexpr float step = 0.5f;
+
+    if (empty())
+        return {};
+
+    // Taps past the border repeat the edge of the image, so obstacles that
+    // touch it still have a normal there
+    sf::Vector2f gradient {
+        interpolate(point + sf::Vector2f{ step, 0.f }) - interpolate(point - sf::Vector2f{ step, 0.f }),
+        interpolate(point + sf::Vector2f{ 0.f, step }) - interpolate(point - sf::Vector2f{ 0.f, step })
+    };
+
+    auto length { std::sqrt(gradient.x * gradient.x + gradient.y * gradient.y) };
+    return length > 1e-6f ? gradient / length : sf::Vector2f{};
+}
@@ -0,0 +1,41 @@
+#ifndef DISTANCE_FIELD_HPP
+#define DISTANCE_FIELD_HPP
+
+#include <SFML/System/Vector2.hpp>
+
+#include <string>
+#include <vector>
+
+// Signed distance to static obstacle geometry, sampled once per pixel of
+// the image it was baked from: negative inside the obstacles, positive
+// outside. A query is one bilinear lookup, whatever the shape of the
+// geometry; outside the image there are no obstacles.
+class DistanceField
+{
+public:
+    // Obstacles are the opaque pixels of the image (alpha above the same
+    // threshold Mesh::loadFromFile uses). The field is sampled in window
+    // coordinates with the image unscaled at the origin, so one image pixel
+    // is one world pixel; unlike meshes, it is not scaled or centered.
+    // Returns false, keeping the current field, if the image has no alpha
+    // channel.
+    bool loadFromFile(std::string const& filename);
+
+    bool empty() const { return values.empty(); }
+
+    float distance(sf::Vector2f point) const;
+    // Direction of steepest increase, by central differences; unit length
+    // unless the field is flat there
+    sf::Vector2f normal(sf::Vector2f point) const;
+
+private:
+    float sample(int x, int y) const { return values[static_cast<std::size_t>(y) * width + x]; }
+    // Bilinear lookup with the point clamped to the image
+    float interpolate(sf::Vector2f point) const;
+
+    int width{ 0 };
+    int height{ 0 };
+    std::vector<float> values{};
+};
+
+#endif // DISTANCE_FIELD_HPP
@@ -0,0 +1,241 @@
+#include "mesh_force_system.hpp"
+
+#include "simd_kernels.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Linearized backward Euler (Baraff & Witkin): with unit masses, the
+// velocity change solves
+//
+//     (I - h D - h^2 K) dv = h (f + h K v)
+//
+// where D = df/dv and K = df/dx are taken at the start of the step. The
+// system is never assembled; conjugate gradients only needs products with
+// it, which reuse the element slots and per-node gather of getDiffs().
+// Pinned nodes are filtered out of every vector, so their dv stays zero.
+
+static float dot(const float* a, const float* b, std::size_t count)
+{
+    double sum { 0.0 };
+    for (std::size_t i = 0; i < count; i++)
+        sum += static_cast<double>(a[i]) * b[i];
+    return static_cast<float>(sum);
+}
+
+void MeshForceSystem::SystemState::linearize(Workspace& workspace, float h) const
+{
+    auto const& system { forceSystem.get() };
+    auto const& springs { system.springs };
+    auto const& triangles { system.triangles };
+    auto& elementForces { workspace.elementForces };
+    auto& springJacobians { workspace.springJacobians };
+    auto& areaGradients { workspace.areaGradients };
+    auto triangleSlots { springs.size() * 2 };
+
+    springJacobians.resize(springs.size());
+    areaGradients.resize(triangles.size());
+
+    // Springs resist stretching along their direction; across it they only
+    // act while stretched, which keeps the matrix positive definite. The
+    // slots receive each element's contribution to the diagonal.
+    workspace.pool.parallelFor(springs.size() + triangles.size(), elementGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto k { begin }; k < std::min(end, springs.size()); k++) {
+            auto const& spring { springs[k] };
+            sf::Vector2f delta { x(spring.a) - x(spring.b), y(spring.a) - y(spring.b) };
+            auto length { std::max(Util::distance({ x(spring.a), y(spring.a) }, { x(spring.b), y(spring.b) }), 1e-6f) };
+
+            auto& jacobian { springJacobians[k] };
+            jacobian.direction = delta / length;
+            jacobian.axialStiffness = springConstant * spring.stiffnessScale;
+            jacobian.lateralStiffness = jacobian.axialStiffness * std::max(0.f, 1.f - spring.restLength / length);
+            jacobian.damping = dampingConstant * spring.stiffnessScale;
+
+            auto nx2 { jacobian.direction.x * jacobian.direction.x };
+            auto ny2 { jacobian.direction.y * jacobian.direction.y };
+            auto axial { h * jacobian.damping + h * h * jacobian.axialStiffness };
+            auto lateral { h * h * jacobian.lateralStiffness };
+            sf::Vector2f diagonal { axial * nx2 + lateral * ny2, axial * ny2 + lateral * nx2 };
+
+            elementForces[2 * k] = diagonal;
+            elementForces[2 * k + 1] = diagonal;
+        }
+
+        for (auto k { std::max(begin, springs.size()) }; k < end; k++) {
+            auto const& tri { triangles[k - springs.size()] };
+            auto& gradients { areaGradients[k - springs.size()] };
+            gradients[0] = 0.5f * sf::Vector2f{y(tri.b) - y(tri.c), x(tri.c) - x(tri.b)};
+            gradients[1] = 0.5f * sf::Vector2f{y(tri.c) - y(tri.a), x(tri.a) - x(tri.c)};
+            gradients[2] = 0.5f * sf::Vector2f{y(tri.a) - y(tri.b), x(tri.b) - x(tri.a)};
+
+            auto slot { triangleSlots + 3 * (k - springs.size()) };
+            for (int j = 0; j < 3; j++) {
+                auto g { gradients[j] };
+                elementForces[slot + j] = h * h * areaSpringConstant * sf::Vector2f{ g.x * g.x, g.y * g.y };
+            }
+        }
+    });
+
+    auto* inverseDiagonal { workspace.inverseDiagonal.data() };
+
+    workspace.pool.parallelFor(count, nodeGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto i { begin }; i < end; i++) {
+            sf::Vector2f diagonal { 1.f + h * airResistance, 1.f + h * airResistance };
+
+            for (int k = system.incidentOffsets[i]; k < system.incidentOffsets[i + 1]; k++)
+                diagonal += elementForces[system.incidentSlots[k]];
+
+            inverseDiagonal[i] = 1.f / diagonal.x;
+            inverseDiagonal[stride + i] = 1.f / diagonal.y;
+        }
+    });
+
+    if (system.dragging && system.draggedNode != -1) {
+        auto node { system.draggedNode };
+        sf::Vector2f delta { x(node) - system.mousePos.x, y(node) - system.mousePos.y };
+        auto length { std::max(Util::distance({ x(node), y(node) }, system.mousePos), 1e-6f) };
+        auto n { delta / length };
+        auto stiffness { h * h * springConstant * 2 };
+
+        inverseDiagonal[node] = 1.f / (1.f / inverseDiagonal[node] + h * dampingConstant * n.x * n.x + stiffness);
+        inverseDiagonal[stride + node] = 1.f / (1.f / inverseDiagonal[stride + node] + h * dampingConstant * n.y * n.y + stiffness);
+    }
+}
+
+// out = identityScale * p - dampingScale * D p - stiffnessScale * K p
+void MeshForceSystem::SystemState::applyJacobians(
+    Workspace& workspace,
+    const float* p, float* out,
+    float identityScale, float dampingScale, float stiffnessScale
+) const {
+    auto const& system { forceSystem.get() };
+    auto const& springs { system.springs };
+    auto const& triangles { system.triangles };
+    auto& elementForces { workspace.elementForces };
+    auto const& springJacobians { workspace.springJacobians };
+    auto const& areaGradients { workspace.areaGradients };
+    auto triangleSlots { springs.size() * 2 };
+    auto const* px { p };
+    auto const* py { p + stride };
+
+    workspace.pool.parallelFor(springs.size() + triangles.size(), elementGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto k { begin }; k < std::min(end, springs.size()); k++) {
+            auto const& spring { springs[k] };
+            auto const& jacobian { springJacobians[k] };
+            auto n { jacobian.direction };
+            sf::Vector2f delta { px[spring.a] - px[spring.b], py[spring.a] - py[spring.b] };
+            auto along { n.x * delta.x + n.y * delta.y };
+
+            auto axial { dampingScale * jacobian.damping + stiffnessScale * jacobian.axialStiffness };
+            auto lateral { stiffnessScale * jacobian.lateralStiffness };
+            auto product { axial * along * n + lateral * (delta - along * n) };
+
+            elementForces[2 * k] = product;
+            elementForces[2 * k + 1] = -product;
+        }
+
+        for (auto k { std::max(begin, springs.size()) }; k < end; k++) {
+            auto const& tri { triangles[k - springs.size()] };
+            auto const& gradients { areaGradients[k - springs.size()] };
+            int nodes[3] { tri.a, tri.b, tri.c };
+
+            float projection { 0.f };
+            for (int j = 0; j < 3; j++)
+                projection += gradients[j].x * px[nodes[j]] + gradients[j].y * py[nodes[j]];
+
+            auto slot { triangleSlots + 3 * (k - springs.size()) };
+            for (int j = 0; j < 3; j++)
+                elementForces[slot + j] = stiffnessScale * areaSpringConstant * projection * gradients[j];
+        }
+    });
+
+    auto* outX { out };
+    auto* outY { out + stride };
+
+    workspace.pool.parallelFor(count, nodeGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto i { begin }; i < end; i++) {
+            sf::Vector2f product {
+                (identityScale + dampingScale * airResistance) * px[i],
+                (identityScale + dampingScale * airResistance) * py[i]
+            };
+
+            for (int k = system.incidentOffsets[i]; k < system.incidentOffsets[i + 1]; k++)
+                product += elementForces[system.incidentSlots[k]];
+
+            outX[i] = product.x;
+            outY[i] = product.y;
+        }
+    });
+
+    if (system.dragging && system.draggedNode != -1) {
+        auto node { system.draggedNode };
+        sf::Vector2f delta { x(node) - system.mousePos.x, y(node) - system.mousePos.y };
+        auto length { std::max(Util::distance({ x(node), y(node) }, system.mousePos), 1e-6f) };
+        auto n { delta / length };
+        sf::Vector2f v { px[node], py[node] };
+        auto product { dampingScale * dampingConstant * (n.x * v.x + n.y * v.y) * n + stiffnessScale * springConstant * 2 * v };
+
+        outX[node] += product.x;
+        outY[node] += product.y;
+    }
+
+    for (auto i : system.fixedNodes)
+        outX[i] = outY[i] = 0.f;
+}
+
+void MeshForceSystem::SystemState::stepImplicitEuler(Workspace& workspace, float h)
+{
+    auto& forces { workspace.k1 };
+    auto half { stride * 2 };
+
+    getDiffs(forces, workspace);
+    linearize(workspace, h);
+
+    auto* dv { workspace.deltaV.data() };
+    auto* r { workspace.residual.data() };
+    auto* z { workspace.preconditioned.data() };
+    auto* d { workspace.direction.data() };
+    auto* q { workspace.product.data() };
+    auto const* inverseDiagonal { workspace.inverseDiagonal.data() };
+
+    // b = h f + h^2 K v; forces on pinned nodes are already zero
+    applyJacobians(workspace, velocities(), q, 0.f, 0.f, 1.f);
+    auto const* f { forces.velocities() };
+    for (std::size_t i = 0; i < half; i++)
+        r[i] = h * f[i] - h * h * q[i];
+    for (auto i : forceSystem.get().fixedNodes)
+        r[i] = r[stride + i] = 0.f;
+
+    std::fill_n(dv, half, 0.f);
+    for (std::size_t i = 0; i < half; i++)
+        z[i] = inverseDiagonal[i] * r[i];
+    std::copy_n(z, half, d);
+
+    auto threshold { solverTolerance * solverTolerance * dot(r, r, half) };
+    auto rz { dot(r, z, half) };
+    int iterations = 0;
+
+    while (iterations < maxSolverIterations && dot(r, r, half) > threshold) {
+        applyJacobians(workspace, d, q, 1.f, h, h * h);
+        auto dq { dot(d, q, half) };
+        if (dq <= 0.f)
+            break;
+
+        auto alpha { rz / dq };
+        Simd::axpy(dv, dv, alpha, d, half);
+        Simd::axpy(r, r, -alpha, q, half);
+        iterations++;
+
+        for (std::size_t i = 0; i < half; i++)
+            z[i] = inverseDiagonal[i] * r[i];
+        auto rzNext { dot(r, z, half) };
+        Simd::axpy(d, z, rzNext / rz, d, half);
+        rz = rzNext;
+    }
+
+    workspace.solverIterations = iterations;
+
+    Simd::axpy(velocities(), velocities(), 1.f, dv, half);
+    Simd::axpy(positions(), positions(), h, velocities(), half);
+}
@@ -0,0 +1,203 @@
+#include "mesh_force_system.hpp"
+
+#include "simd_kernels.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+    // Dormand-Prince 5(4): stage coefficients, where the last row is also
+    // the fifth order solution, and the weights of the error estimate
+    constexpr float dormandPrinceA[7][6] {
+        {},
+        { 1.f / 5 },
+        { 3.f / 40, 9.f / 40 },
+        { 44.f / 45, -56.f / 15, 32.f / 9 },
+        { 19372.f / 6561, -25360.f / 2187, 64448.f / 6561, -212.f / 729 },
+        { 9017.f / 3168, -355.f / 33, 46732.f / 5247, 49.f / 176, -5103.f / 18656 },
+        { 35.f / 384, 0.f, 500.f / 1113, 125.f / 192, -2187.f / 6784, 11.f / 84 },
+    };
+
+    constexpr float dormandPrinceE[7] {
+        71.f / 57600, 0.f, -71.f / 16695, 71.f / 1920, -17253.f / 339200, 22.f / 525, -1.f / 40
+    };
+}
+
+void MeshForceSystem::SystemState::next(Workspace& workspace, float h, Integrator integrator)
+{
+    switch (integrator) {
+    case Integrator::RungeKutta4:
+        stepRungeKutta4(workspace, h);
+        break;
+    case Integrator::SymplecticEuler:
+        stepSymplecticEuler(workspace, h);
+        break;
+    case Integrator::VelocityVerlet:
+        stepVelocityVerlet(workspace, h);
+        break;
+    case Integrator::ImplicitEuler:
+        stepImplicitEuler(workspace, h);
+        break;
+    case Integrator::Xpbd:
+        stepXpbd(workspace, h);
+        break;
+    case Integrator::ProjectiveDynamics:
+        stepProjectiveDynamics(workspace, h);
+        break;
+    case Integrator::DormandPrince:
+        stepDormandPrince(workspace, h);
+        break;
+    }
+
+    if (integrator != Integrator::VelocityVerlet && integrator != Integrator::DormandPrince)
+        workspace.derivativesCached = false;
+}
+
+void MeshForceSystem::SystemState::stepRungeKutta4(Workspace& workspace, float h)
+{
+    auto& K1 { workspace.k1 };
+    auto& K2 { workspace.k2 };
+    auto& K3 { workspace.k3 };
+    auto& K4 { workspace.k4 };
+    auto& scratch { workspace.scratch };
+    auto size { stride * 4 };
+
+    getDiffs(K1, workspace);
+
+    Simd::axpy(scratch.values.data(), values.data(), h / 2, K1.values.data(), size);
+    scratch.getDiffs(K2, workspace);
+
+    Simd::axpy(scratch.values.data(), values.data(), h / 2, K2.values.data(), size);
+    scratch.getDiffs(K3, workspace);
+
+    Simd::axpy(scratch.values.data(), values.data(), h, K3.values.data(), size);
+    scratch.getDiffs(K4, workspace);
+
+    Simd::rk4Combine(
+        values.data(),
+        K1.values.data(), K2.values.data(), K3.values.data(), K4.values.data(),
+        h / 6, size
+    );
+}
+
+// v += h a(x, v), then x += h v with the updated velocity
+void MeshForceSystem::SystemState::stepSymplecticEuler(Workspace& workspace, float h)
+{
+    auto& diffs { workspace.k1 };
+    auto half { stride * 2 };
+
+    getDiffs(diffs, workspace);
+
+    Simd::axpy(velocities(), velocities(), h, diffs.velocities(), half);
+    Simd::axpy(positions(), positions(), h, velocities(), half);
+}
+
+// x += h v + h^2/2 a, v += h/2 (a + a'), where a' is evaluated at the new
+// positions and an Euler-predicted velocity (the damping forces depend on
+// it). a' is kept for the next step, so each step costs one evaluation.
+void MeshForceSystem::SystemState::stepVelocityVerlet(Workspace& workspace, float h)
+{
+    auto& current { workspace.k1 };
+    auto& next { workspace.k2 };
+    auto& predicted { workspace.scratch };
+    auto half { stride * 2 };
+
+    if (!workspace.derivativesCached)
+        getDiffs(current, workspace);
+
+    Simd::axpy(predicted.positions(), positions(), h, velocities(), half);
+    Simd::axpy(predicted.positions(), predicted.positions(), h * h / 2, current.velocities(), half);
+    Simd::axpy(predicted.velocities(), velocities(), h, current.velocities(), half);
+
+    predicted.getDiffs(next, workspace);
+
+    std::copy_n(predicted.positions(), half, positions());
+    Simd::axpy(velocities(), velocities(), h / 2, current.velocities(), half);
+    Simd::axpy(velocities(), velocities(), h / 2, next.velocities(), half);
+
+    std::swap(current, next);
+    workspace.derivativesCached = true;
+}
+
+// Covers h with as many error-controlled steps as it takes. The controller
+// proposal carries over between calls, so quiet phases keep their long
+// steps.
+void MeshForceSystem::SystemState::stepDormandPrince(Workspace& workspace, float h)
+{
+    auto remaining { h };
+    while (remaining > h * 1e-4f)
+        remaining -= adaptiveStep(workspace, remaining);
+}
+
+float MeshForceSystem::SystemState::adaptiveStep(Workspace& workspace, float maxStep)
+{
+    std::array<SystemState*, 7> k {
+        &workspace.k1, &workspace.k2, &workspace.k3, &workspace.k4,
+        &workspace.k5, &workspace.k6, &workspace.k7
+    };
+    auto& stage { workspace.scratch };
+    auto& statistics { workspace.stepStatistics };
+    auto size { stride * 4 };
+
+    // First same as last: k7 of the previous step is k1 of this one
+    if (!workspace.derivativesCached)
+        getDiffs(*k[0], workspace);
+
+    while (true) {
+        auto h { std::min(workspace.proposedStep, maxStep) };
+        auto truncated { h < workspace.proposedStep };
+
+        for (int s = 1; s < 7; s++) {
+            Simd::axpy(stage.values.data(), values.data(), h * dormandPrinceA[s][0], k[0]->values.data(), size);
+            for (int j = 1; j < s; j++) {
+                if (dormandPrinceA[s][j] != 0.f)
+                    Simd::axpy(stage.values.data(), stage.values.data(), h * dormandPrinceA[s][j], k[j]->values.data(), size);
+            }
+            stage.getDiffs(*k[s], workspace);
+        }
+
+        // Root mean square of the scaled error over every component
+        double sum { 0.0 };
+        for (std::size_t block = 0; block < 4; block++) {
+            for (std::size_t i = block * stride; i < block * stride + count; i++) {
+                float error { 0.f };
+                for (int j = 0; j < 7; j++)
+                    error += dormandPrinceE[j] * k[j]->values[i];
+
+                auto scale { absoluteTolerance + relativeTolerance * std::max(std::fabs(values[i]), std::fabs(stage.values[i])) };
+                auto scaled { h * error / scale };
+                sum += static_cast<double>(scaled) * scaled;
+            }
+        }
+        auto error { count > 0 ? static_cast<float>(std::sqrt(sum / (4.0 * count))) : 0.f };
+
+        auto factor { error > 0.f ? std::clamp(0.9f * std::pow(error, -0.2f), 0.2f, 5.f) : 5.f };
+
+        if (error > 1.f && h > minimumAdaptiveStep) {
+            statistics.rejected++;
+            workspace.proposedStep = std::max(h * factor, minimumAdaptiveStep);
+            continue;
+        }
+
+        std::swap(values, stage.values);
+        std::swap(workspace.k1, workspace.k7);
+        workspace.derivativesCached = true;
+
+        // A step cut short to land on the end of the interval says nothing
+        // about how long the next one may be, unless it had to shrink
+        auto next { h * factor };
+        if (truncated)
+            next = std::max(next, workspace.proposedStep);
+        workspace.proposedStep = std::clamp(next, minimumAdaptiveStep, maximumAdaptiveStep);
+
+        statistics.smallest = statistics.accepted > 0 ? std::min(statistics.smallest, h) : h;
+        statistics.largest = std::max(statistics.largest, h);
+        statistics.simulated += h;
+        statistics.accepted++;
+
+        return h;
+    }
+}
@@ -34,6 +34,8 @@ public:
         {
             logFile << system->getMomentum() << std::endl;
             logFile2 << system->getAngularMomentum() << std::endl;
+            logFile3 << MeshForceSystem::integratorName(system->getIntegrator())
+                     << ' ' << system->getEnergy() << std::endl;
         }
     }
 
@@ -41,6 +43,7 @@ private:
     std::weak_ptr<MeshForceSystem> forceSystem;
     std::ofstream logFile{"momentum_log.txt"};
     std::ofstream logFile2{"angular_momentum_log.txt"};
+    std::ofstream logFile3{"energy_log.txt"};
 };
 
 std::unique_ptr<Scene> makeSimulationScene(const sf::Font& textFont)
@@ -49,21 +52,21 @@ std::unique_ptr<Scene> makeSimulationScene(const sf::Font& textFont)
 
     scene->addObject(std::make_shared<Background>());
 
-    auto mesh = std::make_shared<Mesh>(textFont);
-    scene->addObject(mesh);
-
-    auto forceSystem = std::make_shared<MeshForceSystem>(mesh);
+    // Every loaded mesh becomes another body of the same force system,
+    // which updates and draws them
+    auto forceSystem = std::make_shared<MeshForceSystem>();
     scene->addObject(forceSystem);
 
-    std::weak_ptr<Mesh> weakMesh = mesh;
     std::weak_ptr<MeshForceSystem> weakForceSystem = forceSystem;
 
     auto loadMeshButton = std::make_shared<Button>(
         "Load Mesh",
         textFont,
-        [weakMesh, weakForceSystem](){
-            weakMesh.lock()->openFileDialogAndLoad(meshGranularity);
-            weakForceSystem.lock()->reload();
+        [&textFont, weakForceSystem](){
+            auto mesh = std::make_shared<Mesh>(textFont);
+            mesh->openFileDialogAndLoad(meshGranularity);
+            if (mesh->nodeCount() > 0)
+                weakForceSystem.lock()->addBody(mesh);
         }
     );
     loadMeshButton->setPosition({10, 10});
@@ -71,6 +74,30 @@ std::unique_ptr<Scene> makeSimulationScene(const sf::Font& textFont)
 
     scene->addObject(loadMeshButton);
 
+    auto loadObstaclesButton = std::make_shared<Button>(
+        "Load Obstacles",
+        textFont,
+        [weakForceSystem](){
+            weakForceSystem.lock()->openFileDialogAndLoadObstacles();
+        }
+    );
+    loadObstaclesButton->setPosition({20 + loadMeshButton->getBounds().x, 10});
+    loadObstaclesButton->setStyle(Button::Secondary);
+
+    scene->addObject(loadObstaclesButton);
+
+    // Adds a ramp rising from the right end of the ground, once
+    auto addRampButton = std::make_shared<Button>("Add Ramp", textFont);
+    std::weak_ptr<Button> weakAddRampButton = addRampButton;
+    addRampButton->setAction([weakForceSystem, weakAddRampButton](){
+        weakForceSystem.lock()->addLineCollider({ 700.f, 700.f }, { 1000.f, 560.f });
+        weakAddRampButton.lock()->disable();
+    });
+    addRampButton->setPosition({30 + loadMeshButton->getBounds().x + loadObstaclesButton->getBounds().x, 10});
+    addRampButton->setStyle(Button::Secondary);
+
+    scene->addObject(addRampButton);
+
     scene->addObject(std::make_shared<MomentumObserver>(forceSystem));
 
     return scene;
@@ -2,13 +2,14 @@
 
 #include "utilities.hpp"
 
-#include "Line.hpp"
 #include "tinyfiledialogs.h"
 #include "opencv4/opencv2/opencv.hpp"
 #include "PoissonGenerator.h"
 #include "CGAL/Simple_cartesian.h"
 #include "CGAL/Delaunay_triangulation_2.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -66,6 +67,12 @@ void Mesh::loadRawAdjacency(std::string filename)
             // If the nodes are adjacent, insert empty EdgeInfo at [i, j] and [j, i]
             if (adiacenta[i].contains(j))
                 edgeInfo[i][j] = {};
+
+    controlPoints.clear();
+    triangleInfo.clear();
+    buildCompressedAdjacency();
+    buildImageGrid();
+    buildImageSkin();
 }
 
 void Mesh::loadFromFile(std::string filename, float resolution)
@@ -197,6 +204,7 @@ void Mesh::loadFromFile(std::string filename, float resolution)
         adiacenta[idx2][idx1] = adiacenta[idx1][idx2];
     }
 
+    triangleInfo.clear();
     for (auto fit = dt.faces_begin(); fit != dt.faces_end(); ++fit) {
         // Skip faces whose edges are not in the adjacency list
         auto v1 = vertexIndex[fit->vertex(0)];
@@ -230,6 +238,8 @@ void Mesh::loadFromFile(std::string filename, float resolution)
         return;
     }
 
+    controlPoints.clear();
+
     for (int i = 0; i < static_cast<int>(noduri.size()); i++) {
         auto scaledPos = noduri[i].getPosition() * scale;
         noduri[i].setPosition(
@@ -245,6 +255,103 @@ void Mesh::loadFromFile(std::string filename, float resolution)
     for (auto& tri : triangleInfo) {
         tri.restSignedArea *= scale * scale;
     }
+
+    buildCompressedAdjacency();
+    buildImageGrid();
+    buildImageSkin();
+}
+
+void Mesh::buildImageGrid()
+{
+    float width = image.getSize().x * scale;
+    float height = image.getSize().y * scale;
+    gridRows = static_cast<int>(width / meshImageSpacing);
+    gridCols = static_cast<int>(height / meshImageSpacing);
+
+    gridPoints.clear();
+
+    // Meshes without an image of their own get an empty grid
+    if (gridRows < 1 || gridCols < 1 || controlPoints.size() != noduri.size())
+        gridRows = gridCols = 0;
+
+    for (int i = 0; gridCols > 0 && i <= gridRows; ++i)
+        for (int j = 0; j <= gridCols; ++j)
+            gridPoints.emplace_back(j * width / gridCols, i * height / gridRows);
+
+    auto corner = [&](int i, int j) {
+        return i * (gridCols + 1) + j;
+    };
+
+    gridIndices.clear();
+    for (int i = 0; i < gridRows; ++i) {
+        for (int j = 0; j < gridCols; ++j) {
+            gridIndices.insert(gridIndices.end(), { corner(i, j), corner(i, j + 1), corner(i + 1, j) });
+            gridIndices.insert(gridIndices.end(), { corner(i + 1, j), corner(i, j + 1), corner(i + 1, j + 1) });
+        }
+    }
+
+    imageVertices.resize(gridIndices.size());
+    for (std::size_t k = 0; k < gridIndices.size(); k++) {
+        auto rest { gridPoints[gridIndices[k]] };
+        imageVertices[k] = sf::Vertex(rest, rest / scale);
+    }
+
+    imageDeformer.build(controlPoints, gridPoints, imageNeighbors);
+}
+
+void Mesh::buildImageSkin()
+{
+    // Meshes without an image of their own have nothing to skin
+    if (controlPoints.size() != noduri.size()) {
+        skinVertices.clear();
+        return;
+    }
+
+    skinVertices.resize(triangleInfo.size() * 3);
+    for (std::size_t k = 0; k < triangleInfo.size(); k++) {
+        auto const& tri { triangleInfo[k] };
+        int corners[3] { tri.a, tri.b, tri.c };
+        for (int j = 0; j < 3; j++) {
+            auto const& rest { controlPoints[corners[j]] };
+            skinVertices[3 * k + j] = sf::Vertex(rest, rest / scale);
+        }
+    }
+}
+
+void Mesh::setImageWarpNeighbors(int neighbors)
+{
+    imageNeighbors = std::max(neighbors, 0);
+    imageDeformer.build(controlPoints, gridPoints, imageNeighbors);
+}
+
+void Mesh::buildCompressedAdjacency()
+{
+    compressed = {};
+    compressed.offsets.reserve(noduri.size() + 1);
+    compressed.offsets.push_back(0);
+
+    for (int i = 0; i < static_cast<int>(noduri.size()); i++) {
+        auto begin { compressed.neighbors.size() };
+
+        if (adiacenta.contains(i))
+            for (const auto& [neigh, dist] : adiacenta.at(i))
+                compressed.neighbors.push_back(neigh);
+
+        // Sort so the traversal order does not depend on hashing
+        std::sort(compressed.neighbors.begin() + begin, compressed.neighbors.end());
+
+        for (auto k { begin }; k < compressed.neighbors.size(); k++)
+            compressed.restLengths.push_back(adiacenta.at(i).at(compressed.neighbors[k]));
+
+        compressed.offsets.push_back(static_cast<int>(compressed.neighbors.size()));
+    }
+
+    // Each undirected edge once, from its lower-indexed endpoint
+    edgeList.clear();
+    for (int i = 0; i < static_cast<int>(noduri.size()); i++)
+        for (int k = compressed.offsets[i]; k < compressed.offsets[i + 1]; k++)
+            if (compressed.neighbors[k] > i)
+                edgeList.push_back({ i, compressed.neighbors[k], compressed.restLengths[k] });
 }
 
 void Mesh::openFileDialogAndLoad(float resolution)
@@ -282,115 +389,139 @@ void Mesh::deselectEdge(int x, int y)
     edgeInfo[y][x].unhighlight();
 }
 
-static float dot(const sf::Vector2f& a, const sf::Vector2f& b) {
-    return a.x * b.x + a.y * b.y;
+static constexpr int discSegments = 16;
+
+static void appendQuad(std::vector<sf::Vertex>& vertices, sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d, sf::Color color)
+{
+    vertices.insert(vertices.end(), {
+        sf::Vertex(a, color), sf::Vertex(b, color), sf::Vertex(c, color),
+        sf::Vertex(a, color), sf::Vertex(c, color), sf::Vertex(d, color)
+    });
 }
 
-static sf::Vector2f rotated(const sf::Vector2f& v) {
-    return sf::Vector2f{-v.y, v.x};
+// Same shape as selbaward::Line: a quad centered on the segment
+static void appendLine(std::vector<sf::Vertex>& vertices, sf::Vector2f start, sf::Vector2f end, float thickness, sf::Color color)
+{
+    auto direction { end - start };
+    auto length { std::sqrt(direction.x * direction.x + direction.y * direction.y) };
+    if (length < 1e-6f)
+        return;
+
+    auto offset { sf::Vector2f{ -direction.y, direction.x } * (thickness / 2.f / length) };
+    appendQuad(vertices, start - offset, end - offset, end + offset, start + offset, color);
 }
 
-static sf::Vector2f rigidMLS(const sf::Vector2f& v, const std::vector<sf::Vector2f>& p, const std::vector<sf::Vector2f>& q) {
-    const float EPSILON = 1e-8f;
-    size_t n = p.size();
-    std::vector<float> w(n);
-    float w_sum = 0.0f;
-    sf::Vector2f p_star(0, 0), q_star(0, 0);
-
-    for (size_t i = 0; i < n; ++i) {
-        float d2 = std::pow(Util::distance(p[i] - v, {0, 0}), 2.0f);
-        w[i] = 1.0f / std::max(d2, EPSILON);
-        w_sum += w[i];
-        p_star += w[i] * p[i];
-        q_star += w[i] * q[i];
+// Same shape as the node's sf::CircleShape: a disc with its outline around it
+static void appendDisc(std::vector<sf::Vertex>& vertices, sf::Vector2f center, float radius, sf::Color fill, float outlineThickness, sf::Color outline)
+{
+    static auto const circle = [] {
+        std::array<sf::Vector2f, discSegments + 1> points{};
+        for (int s = 0; s <= discSegments; s++) {
+            auto angle { 2.f * static_cast<float>(M_PI) * s / discSegments };
+            points[s] = { std::cos(angle), std::sin(angle) };
+        }
+        return points;
+    }();
+
+    for (int s = 0; s < discSegments; s++) {
+        vertices.insert(vertices.end(), {
+            sf::Vertex(center, fill),
+            sf::Vertex(center + radius * circle[s], fill),
+            sf::Vertex(center + radius * circle[s + 1], fill)
+        });
     }
 
-    p_star /= w_sum;
-    q_star /= w_sum;
+    if (outlineThickness < 0.01f || outline.a == 0)
+        return;
 
-    std::vector<sf::Vector2f> phat(n), qhat(n);
-    for (size_t i = 0; i < n; ++i) {
-        phat[i] = p[i] - p_star;
-        qhat[i] = q[i] - q_star;
+    auto outer { radius + outlineThickness };
+    for (int s = 0; s < discSegments; s++) {
+        appendQuad(vertices,
+            center + radius * circle[s], center + outer * circle[s],
+            center + outer * circle[s + 1], center + radius * circle[s + 1],
+            outline);
     }
+}
 
-    float mu = 0.f;
-    for (size_t i = 0; i < n; ++i)
-        mu += w[i] * dot(phat[i], phat[i]);
-
-    sf::Vector2f result{0, 0};
-    for (size_t i = 0; i < n; ++i) {
-        sf::Vector2 qhat_A{
-            qhat[i].x * dot(phat[i], v - p_star) + qhat[i].y * dot(-rotated(phat[i]), v - p_star),
-            qhat[i].x * dot(phat[i], -rotated(v - p_star)) + qhat[i].y * dot(-rotated(phat[i]), - rotated(v - p_star))
-        };
-        result += qhat_A * w[i] / mu;
+// Streams the vertices into the buffer, which grows ahead of them so it is
+// not recreated every time a few more vertices show up
+static void drawBatch(sf::RenderTarget& target, sf::VertexBuffer& buffer, std::vector<sf::Vertex> const& vertices)
+{
+    if (vertices.empty())
+        return;
+
+    auto fits { buffer.getVertexCount() >= vertices.size() };
+    if (!sf::VertexBuffer::isAvailable() || (!fits && !buffer.create(vertices.size() * 3 / 2))) {
+        target.draw(vertices.data(), vertices.size(), sf::Triangles);
+        return;
     }
 
-    return q_star + result;
+    buffer.update(vertices.data(), vertices.size(), 0);
+    target.draw(buffer, 0, vertices.size());
 }
 
 void Mesh::draw(sf::RenderTarget& target, [[maybe_unused]] sf::RenderStates states) const
 {
-    if (!showImage) {
-        for (int i = 0; i < static_cast<NoduriSSize>(noduri.size()); i++) {
-            for (int j = i + 1; j < static_cast<NoduriSSize>(noduri.size()); j++) {
-                if (isEdge(i, j)) {
-                    sw::Line muchie {
-                        noduri[i].getPosition(),
-                        noduri[j].getPosition(),
-                        edgeInfo.at(i).at(j).thickness(),
-                        edgeInfo.at(i).at(j).color()
-                    };
-
-                    target.draw(muchie);
-                }
-            }
+    if (drawMode == DrawMode::Wireframe) {
+        edgeVertices.clear();
+        for (auto const& edge : edgeList) {
+            auto const& info { edgeInfo.at(edge.a).at(edge.b) };
+            appendLine(edgeVertices, noduri[edge.a].getPosition(), noduri[edge.b].getPosition(), info.thickness(), info.color());
         }
 
+        nodeVertices.clear();
         for (const auto& nod : noduri)
-            target.draw(nod);
-    } else {
-        std::vector<sf::Vector2f> displacedPoints{};
+            appendDisc(nodeVertices, nod.getPosition(), Nod::radius(), nod.fillColor(), nod.outlineThickness(), nod.outlineColor());
+
+        drawBatch(target, edgeBuffer, edgeVertices);
+        drawBatch(target, nodeBuffer, nodeVertices);
+    } else if (drawMode == DrawMode::WarpedImage) {
+        displacedPoints.clear();
         for (const auto& nod : noduri)
             displacedPoints.push_back(nod.getPosition());
-        
-        sf::VertexArray mesh(sf::Triangles);
-        float width = image.getSize().x * scale;
-        float height = image.getSize().y * scale;
-        const int rows = static_cast<int>(width / meshImageSpacing);
-        const int cols = static_cast<int>(height / meshImageSpacing);
-
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                sf::Vector2f tl(j * width / cols, i * height / rows);
-                sf::Vector2f tr((j + 1) * width / cols, i * height / rows);
-                sf::Vector2f bl(j * width / cols, (i + 1) * height / rows);
-                sf::Vector2f br((j + 1) * width / cols, (i + 1) * height / rows);
-
-                sf::Vector2f dtl = rigidMLS(tl, controlPoints, displacedPoints);
-                sf::Vector2f dtr = rigidMLS(tr, controlPoints, displacedPoints);
-                sf::Vector2f dbl = rigidMLS(bl, controlPoints, displacedPoints);
-                sf::Vector2f dbr = rigidMLS(br, controlPoints, displacedPoints);
-
-                mesh.append(sf::Vertex(dtl, tl / scale));
-                mesh.append(sf::Vertex(dtr, tr / scale));
-                mesh.append(sf::Vertex(dbl, bl / scale));
-
-                mesh.append(sf::Vertex(dbl, bl / scale));
-                mesh.append(sf::Vertex(dtr, tr / scale));
-                mesh.append(sf::Vertex(dbr, br / scale));
-            }
+
+        imageDeformer.apply(displacedPoints, warpedPoints);
+
+        for (std::size_t k = 0; k < gridIndices.size(); k++)
+            imageVertices[k].position = warpedPoints[gridIndices[k]];
+
+        target.draw(imageVertices, &image);
+    } else {
+        for (std::size_t k = 0; k < skinVertices.getVertexCount() / 3; k++) {
+            auto const& tri { triangleInfo[k] };
+            skinVertices[3 * k].position = noduri[tri.a].getPosition();
+            skinVertices[3 * k + 1].position = noduri[tri.b].getPosition();
+            skinVertices[3 * k + 2].position = noduri[tri.c].getPosition();
         }
 
-        target.draw(mesh, &image);
+        target.draw(skinVertices, &image);
     }
 }
 
 void Mesh::sendKeyPressed(sf::Keyboard::Key key)
 {
-    if (key == sf::Keyboard::I)
-        showImage = !showImage;
+    if (key == sf::Keyboard::I) {
+        drawMode = static_cast<DrawMode>((static_cast<int>(drawMode) + 1) % drawModeCount);
+    } else if (key == sf::Keyboard::K && imageDeformer.pointCount() > 0) {
+        auto current { std::find(std::begin(neighborChoices), std::end(neighborChoices), imageNeighbors) };
+        auto next { current == std::end(neighborChoices) || current + 1 == std::end(neighborChoices)
+            ? neighborChoices[0] : *(current + 1) };
+        setImageWarpNeighbors(next);
+
+        if (next == 0) {
+            std::cout << "Image warp: all nodes" << std::endl;
+            return;
+        }
+
+        // Measured on the current pose, since truncation is exact at rest
+        std::vector<sf::Vector2f> displacedPoints{};
+        for (const auto& nod : noduri)
+            displacedPoints.push_back(nod.getPosition());
+        auto error { imageDeformer.truncationError(displacedPoints) };
+
+        std::cout << "Image warp: " << next << " nearest nodes, error max " << error.max
+                  << " px, mean " << error.mean << " px" << std::endl;
+    }
 }
 
 void Mesh::EdgeInfo::highlight()
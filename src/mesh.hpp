@@ -3,6 +3,7 @@
 
 #include "object.hpp"
 #include "nod.hpp"
+#include "mls_deformer.hpp"
 
 #include <SFML/Graphics.hpp>
 
@@ -21,6 +22,21 @@ public:
     using NodeList = std::vector<Nod>;
     using AdjacencyMatrix = std::unordered_map<int, std::unordered_map<int, float>>;
 
+    struct Edge
+    {
+        int a{};
+        int b{};
+        float restLength{};
+    };
+
+    struct TriangleInfo
+    {
+        int a{};
+        int b{};
+        int c{};
+        float restSignedArea{};
+    };
+
 private:
     NodeList noduri {};
 
@@ -40,6 +56,8 @@ public:
     bool isEdge(int x, int y) const { return adiacenta.at(x).contains(y); }
     float edgeLength(int x, int y) const;
 
+    std::vector<Edge> const& edges() const { return edgeList; }
+
     void selectEdge(int x, int y);
     void deselectEdge(int x, int y);
 
@@ -47,18 +65,70 @@ public:
 
     void sendKeyPressed(sf::Keyboard::Key key) override;
 
+    // Number of nearest nodes each image grid corner follows, 0 for all
+    void setImageWarpNeighbors(int neighbors);
+    int imageWarpNeighbors() const { return imageNeighbors; }
+
 private:
+    // Flat (CSR) copy of the adjacency: the neighbors of node i are
+    // neighbors[offsets[i]] .. neighbors[offsets[i + 1] - 1].
+    struct CompressedAdjacency
+    {
+        std::vector<int> offsets{};
+        std::vector<int> neighbors{};
+        std::vector<float> restLengths{};
+    };
+
     AdjacencyMatrix adiacenta {};
+    CompressedAdjacency compressed {};
+    std::vector<Edge> edgeList {};
     const sf::Font& font;
 
+    void buildCompressedAdjacency();
+    void buildImageGrid();
+    void buildImageSkin();
+
     sf::Texture image {};
     std::vector<sf::Vector2f> controlPoints {};
 
+    // Corners of the grid the image is drawn on, row by row, in rest pose
+    // coordinates; the deformer maps them to the current node positions
+    std::vector<sf::Vector2f> gridPoints {};
+    int gridRows {};
+    int gridCols {};
+    int imageNeighbors { 0 };
+    MlsDeformer imageDeformer {};
+
+    // Two triangles per grid cell, as indices into gridPoints. The vertex
+    // array keeps its texture coordinates from load; drawing only writes
+    // the warped corners into it.
+    std::vector<int> gridIndices {};
+    mutable std::vector<sf::Vector2f> displacedPoints {};
+    mutable std::vector<sf::Vector2f> warpedPoints {};
+    mutable sf::VertexArray imageVertices { sf::Triangles };
+
+    // Three vertices per simulation triangle, textured by where its corners
+    // were in the image; drawing only copies the node positions in
+    mutable sf::VertexArray skinVertices { sf::Triangles };
+
+    // The wireframe is two draw calls, edge quads and then node discs, each
+    // rebuilt per frame into reused storage and streamed to the GPU
+    mutable std::vector<sf::Vertex> edgeVertices {};
+    mutable std::vector<sf::Vertex> nodeVertices {};
+    mutable sf::VertexBuffer edgeBuffer { sf::Triangles, sf::VertexBuffer::Stream };
+    mutable sf::VertexBuffer nodeBuffer { sf::Triangles, sf::VertexBuffer::Stream };
+
+    static constexpr int neighborChoices[] { 0, 8, 16, 32, 64 };
+
     static constexpr float pointDensity = 0.8f;
     static constexpr float scale = 0.6f;
     static constexpr float meshImageSpacing = 10.f;
 
-    bool showImage { false };
+    // I cycles between the wireframe, the image warped along a grid, and
+    // the image carried by the simulation triangles themselves
+    enum class DrawMode { Wireframe, WarpedImage, SkinnedImage };
+    static constexpr int drawModeCount = 3;
+    DrawMode drawMode { DrawMode::Wireframe };
 
     class EdgeInfo
     {
@@ -82,14 +152,6 @@ private:
 
     std::unordered_map<int, std::unordered_map<int, EdgeInfo>> edgeInfo;
 
-    struct TriangleInfo
-    {
-        int a{};
-        int b{};
-        int c{};
-        float restSignedArea{};
-    };
-
     std::vector<TriangleInfo> triangleInfo{};
 
 public:
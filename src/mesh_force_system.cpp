@@ -3,33 +3,92 @@
 #include "nod.hpp"
 #include "utilities.hpp"
 #include <SFML/System/Vector2.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <utility>
 #include <limits>
 #include <iostream>
 
 MeshForceSystem::SystemState::SystemState(Mesh::NoduriSSize nodeCount, const MeshForceSystem& forceSystem)
-    : count{nodeCount}, values(count * 4), forceSystem{forceSystem}
+    : count{0}, stride{0}, values{}, forceSystem{forceSystem}
 {
+    resize(nodeCount);
+}
+
+void MeshForceSystem::SystemState::resize(Mesh::NoduriSSize newCount)
+{
+    auto newStride { Simd::padded(static_cast<std::size_t>(newCount)) };
+    auto size { newStride * 4 };
+    if (size > values.capacity())
+        allocations++;
+
+    count = newCount;
+    stride = newStride;
+    values.assign(size, 0.f);
 }
 
 float& MeshForceSystem::SystemState::x(int index)
 {
-    return values[index * 4];
+    return values[index];
 }
 
 float& MeshForceSystem::SystemState::y(int index)
 {
-    return values[index * 4 + 1];
+    return values[stride + index];
 }
 
 float& MeshForceSystem::SystemState::xDot(int index)
 {
-    return values[index * 4 + 2];
+    return values[2 * stride + index];
 }
 
 float& MeshForceSystem::SystemState::yDot(int index)
 {
-    return values[index * 4 + 3];
+    return values[3 * stride + index];
+}
+
+float MeshForceSystem::SystemState::x(int index) const
+{
+    return values[index];
+}
+
+float MeshForceSystem::SystemState::y(int index) const
+{
+    return values[stride + index];
+}
+
+float MeshForceSystem::SystemState::xDot(int index) const
+{
+    return values[2 * stride + index];
+}
+
+float MeshForceSystem::SystemState::yDot(int index) const
+{
+    return values[3 * stride + index];
+}
+
+MeshForceSystem::Workspace::Workspace(Mesh::NoduriSSize count, const MeshForceSystem& forceSystem)
+    : k1{count, forceSystem}, k2{count, forceSystem}, k3{count, forceSystem},
+      k4{count, forceSystem}, k5{count, forceSystem}, k6{count, forceSystem},
+      k7{count, forceSystem}, scratch{count, forceSystem}
+{
+    resizeSolver(count);
+}
+
+void MeshForceSystem::Workspace::resize(Mesh::NoduriSSize count)
+{
+    for (auto* buffer : { &k1, &k2, &k3, &k4, &k5, &k6, &k7, &scratch })
+        buffer->resize(count);
+    resizeSolver(count);
+}
+
+void MeshForceSystem::Workspace::resizeSolver(Mesh::NoduriSSize count)
+{
+    auto size { 2 * Simd::padded(static_cast<std::size_t>(count)) };
+    for (auto* buffer : { &deltaV, &residual, &preconditioned, &direction, &product, &inverseDiagonal })
+        buffer->assign(size, 0.f);
+    solverIterations = 0;
 }
 
 static float distanceAdjusted(sf::Vector2f a, sf::Vector2f b)
@@ -63,78 +122,83 @@ static sf::Vector2f springForce(
     return (-springConstant * displacement - dampingConstant * vdotn) * n;
 }
 
-static sf::Vector2f electrostaticForce(
-    sf::Vector2f targetPos,
-    sf::Vector2f sourcePos,
-    float fieldScale
-) {
-    float dist { distanceAdjusted(
-        { targetPos.x, targetPos.y },
-        { sourcePos.x, sourcePos.y }
-    ) };
-    
-    auto distSquared { dist * dist };
-
-    sf::Vector2f directionAway {
-        (targetPos.x - sourcePos.x) / dist,
-        (targetPos.y - sourcePos.y) / dist
-    };
-
-    return {
-        fieldScale * directionAway.x / distSquared,
-        fieldScale * directionAway.y / distSquared
-    };
-}
-
-MeshForceSystem::SystemState MeshForceSystem::SystemState::getDiffs(const Mesh& mesh)
+void MeshForceSystem::SystemState::getDiffs(SystemState& diffs, Workspace& workspace) const
 {
-    MeshForceSystem::SystemState diffs { count, forceSystem };
-    
-    for (int i = 0; i < count; i++) {
-        if (forceSystem.get().fixedNodes.contains(i)) {
-            diffs.xDot(i) = 0;
-            diffs.yDot(i) = 0;
-            continue;
+    auto const& system { forceSystem.get() };
+    auto const& springs { system.springs };
+    auto const& triangles { system.triangles };
+    auto& elementForces { workspace.elementForces };
+    auto triangleSlots { springs.size() * 2 };
+
+    // Each spring is evaluated once and its force stored with opposite
+    // signs for both ends; a spring pulling against a fixed node acts twice
+    // as strongly. No two elements share a slot, so this splits freely.
+    workspace.pool.parallelFor(springs.size() + triangles.size(), elementGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto k { begin }; k < std::min(end, springs.size()); k++) {
+            auto const& spring { springs[k] };
+            auto force { springForce(
+                { x(spring.a), y(spring.a) },
+                { xDot(spring.a), yDot(spring.a) },
+                { x(spring.b), y(spring.b) },
+                { xDot(spring.b), yDot(spring.b) },
+                spring.restLength, springConstant, dampingConstant
+            ) * spring.stiffnessScale };
+
+            elementForces[2 * k] = force;
+            elementForces[2 * k + 1] = -force;
         }
 
-        diffs.x(i) = xDot(i);
-        diffs.y(i) = yDot(i);
-
-        diffs.xDot(i) = -airResistance * xDot(i);
-        diffs.yDot(i) = -airResistance * yDot(i);
+        for (auto k { std::max(begin, springs.size()) }; k < end; k++) {
+            auto const& tri { triangles[k - springs.size()] };
+            float areaDiff = Util::signedArea(
+                {x(tri.a), y(tri.a)},
+                {x(tri.b), y(tri.b)},
+                {x(tri.c), y(tri.c)}
+            ) - tri.restSignedArea;
 
-        if (forceSystem.get().gravity) {
-            diffs.yDot(i) += gravityStrength;
+            auto gradient_a = 0.5f * sf::Vector2f{y(tri.b) - y(tri.c), x(tri.c) - x(tri.b)};
+            auto gradient_b = 0.5f * sf::Vector2f{y(tri.c) - y(tri.a), x(tri.a) - x(tri.c)};
+            auto gradient_c = 0.5f * sf::Vector2f{y(tri.a) - y(tri.b), x(tri.b) - x(tri.a)};
 
-            auto electrostatic { electrostaticForce(
-                { x(i), y(i) },
-                { x(i), groundLevel },
-                fieldScale
-            ) };
+            auto forceCoef = areaSpringConstant * areaDiff;
+            auto slot { triangleSlots + 3 * (k - springs.size()) };
 
-            diffs.yDot(i) += electrostatic.y;
+            elementForces[slot] = -forceCoef * gradient_a;
+            elementForces[slot + 1] = -forceCoef * gradient_b;
+            elementForces[slot + 2] = -forceCoef * gradient_c;
         }
+    });
 
+    Simd::NodeForceParams nodeParams {
+        airResistance,
+        system.gravity,
+        gravityStrength
+    };
 
-        for (int j = 0; j < count; j++) {
+    // Every node sums its slots in a fixed order, so the result does not
+    // depend on how many threads took part.
+    workspace.pool.parallelFor(count, nodeGrain, [&](std::size_t begin, std::size_t end) {
+        auto length { end - begin };
 
-            if (i == j || !mesh.isEdge(i, j))
-                continue;
+        // Position derivatives are the velocities
+        std::copy_n(xDots() + begin, length, diffs.xs() + begin);
+        std::copy_n(yDots() + begin, length, diffs.ys() + begin);
 
-            auto spring { springForce(
-                { x(i), y(i) },
-                { xDot(i), yDot(i) },
-                { x(j), y(j) },
-                { xDot(j), yDot(j) },
-                mesh.edgeLength(i, j), springConstant, dampingConstant
-            )};
+        Simd::nodeForces(
+            diffs.xDots() + begin, diffs.yDots() + begin,
+            xDots() + begin, yDots() + begin,
+            nodeParams, length
+        );
 
-            auto fixedCoef = forceSystem.get().fixedNodes.contains(j) ? 2.f : 1.f;
+        for (auto i { begin }; i < end; i++) {
+            sf::Vector2f force { 0.f, 0.f };
+            for (int k = system.incidentOffsets[i]; k < system.incidentOffsets[i + 1]; k++)
+                force += elementForces[system.incidentSlots[k]];
 
-            diffs.xDot(i) += spring.x * fixedCoef;
-            diffs.yDot(i) += spring.y * fixedCoef;
+            diffs.xDots()[i] += force.x;
+            diffs.yDots()[i] += force.y;
         }
-    }
+    });
 
     if (forceSystem.get().dragging) {
         auto mousePos { forceSystem.get().mousePos };
@@ -155,36 +219,97 @@ MeshForceSystem::SystemState MeshForceSystem::SystemState::getDiffs(const Mesh&
             diffs.yDot(draggedNode) += mouseForce.y;
         }
     }
-    
-    for (auto const& tri : mesh.triangles()) {
-        float areaDiff = Util::signedArea(
-            {x(tri.a), y(tri.a)},
-            {x(tri.b), y(tri.b)},
-            {x(tri.c), y(tri.c)}
-        ) - tri.restSignedArea;
-
-        auto gradient_a = 0.5f * sf::Vector2f{y(tri.b) - y(tri.c), x(tri.c) - x(tri.b)};
-        auto gradient_b = 0.5f * sf::Vector2f{y(tri.c) - y(tri.a), x(tri.a) - x(tri.c)};
-        auto gradient_c = 0.5f * sf::Vector2f{y(tri.a) - y(tri.b), x(tri.b) - x(tri.a)};
-
-        auto forceCoef = areaSpringConstant * areaDiff;
-        
-        diffs.xDot(tri.a) += -forceCoef * gradient_a.x;
-        diffs.xDot(tri.b) += -forceCoef * gradient_b.x;
-        diffs.xDot(tri.c) += -forceCoef * gradient_c.x;
-
-        diffs.yDot(tri.a) += -forceCoef * gradient_a.y;
-        diffs.yDot(tri.b) += -forceCoef * gradient_b.y;
-        diffs.yDot(tri.c) += -forceCoef * gradient_c.y;
+
+    // Forces accumulated on fixed nodes above are discarded
+    for (auto i : system.fixedNodes)
+        diffs.x(i) = diffs.y(i) = diffs.xDot(i) = diffs.yDot(i) = 0.f;
+}
+
+float MeshForceSystem::getMomentum() const
+{
+    return snapshots.readBuffer().momentum;
+}
+
+float MeshForceSystem::getAngularMomentum() const
+{
+    return snapshots.readBuffer().angularMomentum;
+}
+
+std::uint64_t MeshForceSystem::getDroppedSteps() const
+{
+    return snapshots.readBuffer().droppedSteps;
+}
+
+int MeshForceSystem::getLastTickSteps() const
+{
+    return snapshots.readBuffer().lastTickSteps;
+}
+
+float MeshForceSystem::getEnergy() const
+{
+    return snapshots.readBuffer().energy;
+}
+
+MeshForceSystem::Integrator MeshForceSystem::getIntegrator() const
+{
+    return snapshots.readBuffer().integrator;
+}
+
+int MeshForceSystem::getSolverIterations() const
+{
+    return snapshots.readBuffer().solverIterations;
+}
+
+MeshForceSystem::StepStatistics MeshForceSystem::getStepStatistics() const
+{
+    return snapshots.readBuffer().stepStatistics;
+}
+
+float MeshForceSystem::baseStepSize() const
+{
+    switch (integrator) {
+    case Integrator::ImplicitEuler:
+    case Integrator::Xpbd:
+    case Integrator::ProjectiveDynamics:
+    case Integrator::DormandPrince:
+        return frameStepSize;
+    default:
+        return stepSize;
     }
+}
 
-    return diffs;
+const char* MeshForceSystem::integratorName(Integrator integrator)
+{
+    switch (integrator) {
+    case Integrator::RungeKutta4:
+        return "RK4";
+    case Integrator::SymplecticEuler:
+        return "symplectic Euler";
+    case Integrator::VelocityVerlet:
+        return "velocity Verlet";
+    case Integrator::ImplicitEuler:
+        return "implicit Euler";
+    case Integrator::Xpbd:
+        return "XPBD";
+    case Integrator::ProjectiveDynamics:
+        return "projective dynamics";
+    case Integrator::DormandPrince:
+        return "Dormand-Prince";
+    }
+    return "unknown";
 }
 
-float MeshForceSystem::getMomentum()
+void MeshForceSystem::setIntegrator(Integrator newIntegrator)
+{
+    Command command { Command::Type::SetIntegrator };
+    command.integrator = newIntegrator;
+    sendCommand(command);
+}
+
+float MeshForceSystem::computeMomentum() const
 {
     sf::Vector2f momentum { 0.f, 0.f };
-    auto nodeCount { mesh.lock()->nodeCount() };
+    auto nodeCount { state.size() };
     for (int i = 0; i < nodeCount; i++) {
         momentum.x += state.xDot(i);
         momentum.y += state.yDot(i);
@@ -192,67 +317,343 @@ float MeshForceSystem::getMomentum()
     return Util::distance(momentum, { 0.f, 0.f });
 }
 
-float MeshForceSystem::getAngularMomentum()
+float MeshForceSystem::computeAngularMomentum() const
 {
     float angularMomentum { 0.f };
-    auto nodeCount { mesh.lock()->nodeCount() };
+    auto nodeCount { state.size() };
     for (int i = 0; i < nodeCount; i++) {
         angularMomentum += state.x(i) * state.yDot(i) - state.y(i) * state.xDot(i);
     }
     return angularMomentum;
 }
 
-void MeshForceSystem::SystemState::next(const Mesh& mesh)
+float MeshForceSystem::computeEnergy() const
+{
+    float energy { 0.f };
+
+    for (int i = 0; i < state.size(); i++) {
+        energy += 0.5f * (state.xDot(i) * state.xDot(i) + state.yDot(i) * state.yDot(i));
+
+        if (gravity)
+            energy += -gravityStrength * state.y(i);
+    }
+
+    for (auto const& spring : springs) {
+        auto stretch { distanceAdjusted(
+            { state.x(spring.a), state.y(spring.a) },
+            { state.x(spring.b), state.y(spring.b) }
+        ) - spring.restLength };
+        energy += 0.5f * springConstant * spring.stiffnessScale * stretch * stretch;
+    }
+
+    for (auto const& tri : triangles) {
+        auto areaDiff { Util::signedArea(
+            { state.x(tri.a), state.y(tri.a) },
+            { state.x(tri.b), state.y(tri.b) },
+            { state.x(tri.c), state.y(tri.c) }
+        ) - tri.restSignedArea };
+        energy += 0.5f * areaSpringConstant * areaDiff * areaDiff;
+    }
+
+    return energy;
+}
+
+static bool overlaps(SpatialHash::Box const& a, SpatialHash::Box const& b)
 {
-    auto scaleByStepSize = [&](auto& state) {
-        for (int i = 0; i < count * 4; i++)
-            state.values[i] *= stepSize;
+    return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+void MeshForceSystem::addBody(std::shared_ptr<Mesh> mesh)
+{
+    stop();
+
+    auto keepCount { static_cast<int>(state.size()) };
+
+    auto boundsOf = [](auto first, auto last, auto position) {
+        SpatialHash::Box box { position(first), position(first) };
+        for (auto i { first }; i < last; i++) {
+            auto p { position(i) };
+            box.min = { std::min(box.min.x, p.x), std::min(box.min.y, p.y) };
+            box.max = { std::max(box.max.x, p.x), std::max(box.max.y, p.y) };
+        }
+        return box;
     };
 
-    auto stateK1 { *this };
-    auto K1 { stateK1.getDiffs(mesh) };
-    scaleByStepSize(K1);
+    // Meshes load at the window center, so a new body goes to a free spot
+    // in the window: where it loaded if that is clear, else right of the
+    // other bodies, else above them, else the first gap scanning the window
+    // from the top. With no gap left it goes to the top edge.
+    if (mesh->nodeCount() > 0 && keepCount > 0) {
+        std::vector<SpatialHash::Box> occupied{};
+        for (auto const& body : bodies) {
+            auto last { body.nodeOffset + static_cast<int>(body.mesh->nodeCount()) };
+            occupied.push_back(boundsOf(body.nodeOffset, last, [&](int i) { return sf::Vector2f{ state.x(i), state.y(i) }; }));
+        }
 
-    auto stateK2 { stateK1 };
-    for (int i = 0; i < count * 4; i++)
-        stateK2.values[i] += K1.values[i] / 2;
-    auto K2 { stateK2.getDiffs(mesh) };
-    scaleByStepSize(K2);
+        auto box { boundsOf(0, static_cast<int>(mesh->nodeCount()), [&](int i) { return mesh->node(i).getPosition(); }) };
+        auto size { box.max - box.min };
+        auto world { occupied[0] };
+        for (auto const& other : occupied)
+            world = { { std::min(world.min.x, other.min.x), std::min(world.min.y, other.min.y) },
+                      { std::max(world.max.x, other.max.x), std::max(world.max.y, other.max.y) } };
+
+        // Bodies stay above the ground, which comes with gravity
+        sf::Vector2f window { static_cast<float>(Util::windowSize.x), std::min(static_cast<float>(Util::windowSize.y), groundLevel) };
+        auto isFree = [&](sf::Vector2f corner) {
+            if (corner.x < 0.f || corner.y < 0.f || corner.x + size.x > window.x || corner.y + size.y > window.y)
+                return false;
+            sf::Vector2f margin { bodySpacing / 2.f, bodySpacing / 2.f };
+            SpatialHash::Box moved { corner - margin, corner + size + margin };
+            return std::none_of(occupied.begin(), occupied.end(), [&](auto const& other) { return overlaps(moved, other); });
+        };
+
+        std::vector<sf::Vector2f> spots {
+            box.min,
+            { world.max.x + bodySpacing, box.min.y },
+            { box.min.x, world.min.y - bodySpacing - size.y }
+        };
+        for (auto y { 0.f }; y + size.y <= window.y; y += bodySpacing) {
+            for (auto x { 0.f }; x + size.x <= window.x; x += bodySpacing)
+                spots.push_back({ x, y });
+        }
 
-    auto stateK3 { stateK1 };
-    for (int i = 0; i < count * 4; i++)
-        stateK3.values[i] += K2.values[i] / 2;
-    auto K3 { stateK3.getDiffs(mesh) };
-    scaleByStepSize(K3);
+        auto free { std::find_if(spots.begin(), spots.end(), isFree) };
+        auto corner { free != spots.end() ? *free : sf::Vector2f{ std::clamp(box.min.x, 0.f, std::max(window.x - size.x, 0.f)), 0.f } };
 
-    auto stateK4 { stateK1 };
-    for (int i = 0; i < count * 4; i++)
-        stateK3.values[i] += K3.values[i];
-    auto K4 { stateK4.getDiffs(mesh) };
-    scaleByStepSize(K4);
+        for (auto& node : mesh->getNodes())
+            node.setPosition(node.getPosition() + corner - box.min);
+    }
 
-    for (int i = 0; i < count * 4; i++)
-        values[i] += (K1.values[i] + 2. * K2.values[i] + 2. * K3.values[i] + K4.values[i]) / 6.;
+    bodies.push_back({ std::move(mesh) });
+    rebuildWorld(keepCount);
 }
 
-void MeshForceSystem::reload()
+void MeshForceSystem::rebuildWorld(int keepCount)
 {
-    state = SystemState { mesh.lock()->nodeCount(), *this };
-    
-    for (int i = 0; i < mesh.lock()->nodeCount(); i++) {
-        state.x(i) = mesh.lock()->node(i).getPosition().x;
-        state.y(i) = mesh.lock()->node(i).getPosition().y;
-        state.xDot(i) = state.yDot(i) = 0.f;
+    stop();
+
+    Command stale{};
+    while (commands.pop(stale)) {}
+
+    edges.clear();
+    triangles.clear();
+
+    int nodeCount { 0 };
+    for (auto& body : bodies) {
+        body.nodeOffset = nodeCount;
+
+        for (auto const& edge : body.mesh->edges())
+            edges.push_back({ edge.a + nodeCount, edge.b + nodeCount, edge.restLength });
+        for (auto const& tri : body.mesh->triangles())
+            triangles.push_back({ tri.a + nodeCount, tri.b + nodeCount, tri.c + nodeCount, tri.restSignedArea });
+
+        nodeCount += static_cast<int>(body.mesh->nodeCount());
+    }
+
+    std::vector<std::array<float, 4>> kept(keepCount);
+    for (int i = 0; i < keepCount; i++)
+        kept[i] = { state.x(i), state.y(i), state.xDot(i), state.yDot(i) };
+
+    state.resize(nodeCount);
+    workspace.resize(nodeCount);
+    workspace.derivativesCached = false;
+
+    dragging = false;
+    draggedNode = -1;
+    highlightedNode = -1;
+    wake();
+
+    fixedMask.resize(keepCount);
+    fixedMask.resize(nodeCount, 0);
+    std::erase_if(fixedNodes, [&](int node) { return node >= keepCount; });
+    shownPins.resize(keepCount);
+    shownPins.resize(nodeCount, 0);
+    restPositions.resize(keepCount);
+
+    for (int i = 0; i < nodeCount; i++) {
+        if (i < keepCount) {
+            state.x(i) = kept[i][0];
+            state.y(i) = kept[i][1];
+            state.xDot(i) = kept[i][2];
+            state.yDot(i) = kept[i][3];
+        } else {
+            auto position { nodeAt(i).getPosition() };
+            state.x(i) = position.x;
+            state.y(i) = position.y;
+            state.xDot(i) = state.yDot(i) = 0.f;
+            restPositions.push_back(position);
+        }
+    }
+
+    rebuildSprings();
+    buildBoundary();
+    stepStart.resize(nodeCount);
+
+    // The topology never changes between rebuilds, so the projective
+    // dynamics system is factored here
+    state.prepareProjective(workspace, frameStepSize);
+
+    startPhysics();
+}
+
+void MeshForceSystem::startPhysics()
+{
+    // The thread is not running yet, so this thread may act as the producer
+    publishSnapshot(0);
+
+    physicsThread = std::jthread { [this](std::stop_token stopToken) {
+        runPhysics(stopToken);
+    } };
+}
+
+int MeshForceSystem::bodyOf(int node) const
+{
+    auto after { std::upper_bound(bodies.begin(), bodies.end(), node, [](int index, Body const& body) {
+        return index < body.nodeOffset;
+    }) };
+    return static_cast<int>(after - bodies.begin()) - 1;
+}
+
+Nod& MeshForceSystem::nodeAt(int node) const
+{
+    auto const& body { bodies[bodyOf(node)] };
+    return body.mesh->node(node - body.nodeOffset);
+}
+
+void MeshForceSystem::stop()
+{
+    if (!physicsThread.joinable())
+        return;
+
+    physicsThread.request_stop();
+    physicsThread.join();
+}
+
+void MeshForceSystem::runPhysics(std::stop_token stopToken)
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto const tick { std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(1.f / physicsRate)
+    ) };
+    auto nextTick { Clock::now() };
+    auto lastTick { nextTick };
+
+    // Simulated time owed but not yet stepped, and the measured wall time
+    // per step used to predict how many steps fit in the budget
+    float accumulator { 0.f };
+    float stepCost { 0.f };
+
+    while (!stopToken.stop_requested()) {
+        Command command{};
+        while (commands.pop(command))
+            applyCommand(command);
+
+        auto now { Clock::now() };
+        accumulator += std::chrono::duration<float>(now - lastTick).count() * timeScale;
+        lastTick = now;
+
+        // A sleeping body owes no time
+        if (sleeping)
+            accumulator = 0.f;
+
+        auto baseStep { baseStepSize() };
+        auto wanted { static_cast<int>(accumulator / baseStep) };
+        auto affordable { wanted };
+        if (wanted > 0 && stepCost > 0.f)
+            affordable = std::clamp(static_cast<int>(computeBudget / stepCost), 1, wanted);
+
+        // Projective dynamics keeps the step its matrix was factored for;
+        // a new h every overloaded tick would refactor it every tick
+        auto steps { affordable };
+        auto h { baseStep };
+        if (affordable < wanted && overloadPolicy == OverloadPolicy::LargerSteps && integrator != Integrator::ProjectiveDynamics)
+            h = std::min(accumulator / affordable, baseStep * maxStepGrowth);
+
+        for (int i = 0; i < steps; i++) {
+            for (int n = 0; n < state.size(); n++)
+                stepStart[n] = { state.x(n), state.y(n) };
+
+            state.next(workspace, h, integrator);
+            // Static contacts go last, so nothing ends a step inside the ground
+            auto moved { resolveCollisions() };
+            if (resolveStaticContacts(h) || moved)
+                workspace.derivativesCached = false;
+        }
+        accumulator -= steps * h;
+
+        if (steps > 0) {
+            auto cost { std::chrono::duration<float>(Clock::now() - now).count() / steps };
+            stepCost = stepCost > 0.f ? 0.8f * stepCost + 0.2f * cost : cost;
+            updateSleep(steps * h);
+        }
+
+        // Whatever did not fit in the budget is given up on; only the
+        // fraction of a step is carried over
+        auto dropped { static_cast<int>(accumulator / baseStep) };
+        droppedSteps += dropped;
+        accumulator -= dropped * baseStep;
+
+        // Nothing changes while asleep; the last snapshot stays current
+        if (steps > 0 || !sleeping)
+            publishSnapshot(steps);
+
+        // Run at a fixed rate; after a long stall, resume instead of
+        // trying to catch up
+        nextTick += tick;
+        now = Clock::now();
+        if (now > nextTick + 4 * tick)
+            nextTick = now;
+
+        std::this_thread::sleep_until(nextTick);
     }
 }
 
-void MeshForceSystem::update([[maybe_unused]] float deltaTime)
+void MeshForceSystem::publishSnapshot(int lastTickSteps)
 {
-    for (int i = 0; i < 100; i++)
-        state.next(*mesh.lock());
+    auto& snapshot { snapshots.writeBuffer() };
+
+    snapshot.positions.resize(state.size());
+    for (int i = 0; i < state.size(); i++)
+        snapshot.positions[i] = { state.x(i), state.y(i) };
+
+    snapshot.momentum = computeMomentum();
+    snapshot.angularMomentum = computeAngularMomentum();
+    snapshot.energy = computeEnergy();
+    snapshot.gravity = gravity;
+    snapshot.integrator = integrator;
+    snapshot.droppedSteps = droppedSteps;
+    snapshot.lastTickSteps = lastTickSteps;
+    snapshot.solverIterations = workspace.solverIterations;
+    snapshot.stepStatistics = workspace.stepStatistics;
+    snapshot.sleeping = sleeping;
+    snapshot.collisionStatistics = collisionStatistics;
+    snapshot.broadPhase = broadPhase;
+    collisionStatistics.candidates = collisionStatistics.contacts = collisionStatistics.staticContacts = collisionStatistics.sweptContacts = 0;
+    collisionStatistics.broadPhaseSeconds = collisionStatistics.narrowPhaseSeconds = 0.f;
+    workspace.stepStatistics = {};
+
+    snapshots.publish();
+}
 
-    for (int i = 0; i < mesh.lock()->nodeCount(); i++)
-        mesh.lock()->node(i).setPosition({ state.x(i), state.y(i) });
+void MeshForceSystem::update(float deltaTime)
+{
+    for (auto const& body : bodies)
+        body.mesh->update(deltaTime);
+
+    if (!snapshots.update())
+        return;
+
+    // All bodies are written in one pass over the global positions
+    auto const& positions { snapshots.readBuffer().positions };
+    if (static_cast<Mesh::NoduriSSize>(positions.size()) != state.size())
+        return;
+
+    for (auto const& body : bodies) {
+        auto const* bodyPositions { positions.data() + body.nodeOffset };
+        for (int i = 0; i < body.mesh->nodeCount(); i++)
+            body.mesh->node(i).setPosition(bodyPositions[i]);
+    }
 }
 
 int MeshForceSystem::getClosestNodeTo(sf::Vector2f coords) const
@@ -260,71 +661,257 @@ int MeshForceSystem::getClosestNodeTo(sf::Vector2f coords) const
     int closestToMouse { -1 };
     float closestDistance { std::numeric_limits<float>::max() };
 
-    for (int i = 0; i < mesh.lock()->nodeCount(); i++)
-        if (Util::distance(mesh.lock()->node(i).getPosition(), coords) < closestDistance) {
-            closestDistance = Util::distance(mesh.lock()->node(i).getPosition(), coords);
-            closestToMouse = i;
-        }
+    for (auto const& body : bodies) {
+        for (int i = 0; i < body.mesh->nodeCount(); i++)
+            if (Util::distance(body.mesh->node(i).getPosition(), coords) < closestDistance) {
+                closestDistance = Util::distance(body.mesh->node(i).getPosition(), coords);
+                closestToMouse = body.nodeOffset + i;
+            }
+    }
 
     return closestToMouse;
 }
 
-void MeshForceSystem::sendLeftButtonPressed(sf::Vector2f coords)
+void MeshForceSystem::sendCommand(Command const& command)
+{
+    // Without a running physics thread nobody would drain the queue
+    if (!physicsThread.joinable())
+        return;
+
+    while (!commands.push(command))
+        std::this_thread::yield();
+}
+
+void MeshForceSystem::applyCommand(Command const& command)
+{
+    switch (command.type) {
+    case Command::Type::Grab:
+        dragging = true;
+        draggedNode = command.node;
+        mousePos = command.coords;
+        break;
+    case Command::Type::MoveMouse:
+        mousePos = command.coords;
+        // Moving the mouse only matters to a body that is being dragged
+        if (!dragging)
+            return;
+        break;
+    case Command::Type::Release:
+        dragging = false;
+        draggedNode = -1;
+        break;
+    case Command::Type::TogglePin:
+        fixedMask[command.node] = !fixedMask[command.node];
+        if (fixedMask[command.node]) {
+            // Schemes that move positions by the velocity directly rely on
+            // pinned nodes being at rest
+            state.xDot(command.node) = state.yDot(command.node) = 0.f;
+            fixedNodes.push_back(command.node);
+        }
+        else
+            std::erase(fixedNodes, command.node);
+        rebuildSprings();
+        // Pins are part of the projective dynamics matrix
+        workspace.projectiveStepSize = 0.f;
+        break;
+    case Command::Type::ToggleGravity:
+        gravity = !gravity;
+        break;
+    case Command::Type::SetIntegrator:
+        integrator = command.integrator;
+        break;
+    case Command::Type::SetBroadPhase:
+        broadPhase = command.broadPhase;
+        break;
+    }
+
+    // Every command changes the forces
+    workspace.derivativesCached = false;
+    wake();
+}
+
+void MeshForceSystem::updateSleep(float simulated)
+{
+    auto threshold { sleepSpeed * sleepSpeed };
+    auto resting { true };
+    for (int i = 0; i < state.size() && resting; i++)
+        resting = state.xDot(i) * state.xDot(i) + state.yDot(i) * state.yDot(i) < threshold;
+
+    restTime = resting ? restTime + simulated : 0.f;
+    if (restTime < sleepDelay || dragging)
+        return;
+
+    sleeping = true;
+    for (int i = 0; i < state.size(); i++)
+        state.xDot(i) = state.yDot(i) = 0.f;
+    workspace.derivativesCached = false;
+}
+
+void MeshForceSystem::wake()
+{
+    sleeping = false;
+    restTime = 0.f;
+}
+
+bool MeshForceSystem::isSleeping() const
+{
+    return snapshots.readBuffer().sleeping;
+}
+
+MeshForceSystem::CollisionStatistics MeshForceSystem::getCollisionStatistics() const
+{
+    return snapshots.readBuffer().collisionStatistics;
+}
+
+void MeshForceSystem::setBroadPhase(BroadPhase newBroadPhase)
+{
+    Command command { Command::Type::SetBroadPhase };
+    command.broadPhase = newBroadPhase;
+    sendCommand(command);
+}
+
+MeshForceSystem::BroadPhase MeshForceSystem::getBroadPhase() const
+{
+    return snapshots.readBuffer().broadPhase;
+}
+
+const char* MeshForceSystem::broadPhaseName(BroadPhase broadPhase)
 {
-    dragging = true;
-    mousePos = coords;
+    switch (broadPhase) {
+    case BroadPhase::HashGrid:
+        return "spatial hash";
+    case BroadPhase::BoundingVolumes:
+        return "bounding volume trees";
+    }
+    return "unknown";
+}
 
-    draggedNode = getClosestNodeTo(coords);
+void MeshForceSystem::sendLeftButtonPressed(sf::Vector2f coords)
+{
+    highlightedNode = getClosestNodeTo(coords);
 
-    if (draggedNode != -1) {
-        auto& node { mesh.lock()->node(draggedNode) };
+    if (highlightedNode != -1) {
+        auto& node { nodeAt(highlightedNode) };
         node.highlight();
     }
+
+    sendCommand({ Command::Type::Grab, highlightedNode, coords });
 }
 
 void MeshForceSystem::sendLeftButtonReleased([[maybe_unused]] sf::Vector2f coords)
 {
-    dragging = false;
-    if (draggedNode == -1)
+    sendCommand({ Command::Type::Release });
+
+    if (highlightedNode == -1)
         return;
 
-    mesh.lock()->node(draggedNode).unhighlight();
-    draggedNode = -1;
+    nodeAt(highlightedNode).unhighlight();
+    highlightedNode = -1;
 }
 
 void MeshForceSystem::sendRightButtonPressed([[maybe_unused]] sf::Vector2f coords)
 {
     auto closestNode { getClosestNodeTo(coords) };
     if (closestNode != -1) {
-        if (fixedNodes.contains(closestNode)) {
-            fixedNodes.erase(closestNode);
-            mesh.lock()->node(closestNode).resetColor();
+        if (shownPins[closestNode]) {
+            shownPins[closestNode] = 0;
+            nodeAt(closestNode).resetColor();
         } else {
-            fixedNodes.insert(closestNode);
-            mesh.lock()->node(closestNode).setColor({ 200, 0, 200, 200 });
+            shownPins[closestNode] = 1;
+            nodeAt(closestNode).setColor({ 200, 0, 200, 200 });
         }
+
+        sendCommand({ Command::Type::TogglePin, closestNode });
     }
 }
 
+void MeshForceSystem::rebuildSprings()
+{
+    springs.clear();
+
+    for (auto const& edge : edges) {
+        if (fixedMask[edge.a] && fixedMask[edge.b])
+            continue;
+
+        // Only the free end of a half-pinned spring keeps its force
+        auto stiffnessScale { fixedMask[edge.a] || fixedMask[edge.b] ? 2.f : 1.f };
+        springs.push_back({ edge.a, edge.b, edge.restLength, stiffnessScale });
+    }
+
+    buildIncidence();
+}
+
+void MeshForceSystem::buildIncidence()
+{
+    auto nodeCount { state.size() };
+
+    std::vector<int> slotNodes{};
+    slotNodes.reserve(springs.size() * 2 + triangles.size() * 3);
+    for (auto const& spring : springs)
+        slotNodes.insert(slotNodes.end(), { spring.a, spring.b });
+    for (auto const& tri : triangles)
+        slotNodes.insert(slotNodes.end(), { tri.a, tri.b, tri.c });
+
+    // Counting sort of the slots by node, keeping slot order within a node
+    incidentOffsets.assign(nodeCount + 1, 0);
+    for (auto node : slotNodes)
+        incidentOffsets[node + 1]++;
+    for (int i = 0; i < nodeCount; i++)
+        incidentOffsets[i + 1] += incidentOffsets[i];
+
+    incidentSlots.resize(slotNodes.size());
+    std::vector<int> fill { incidentOffsets.begin(), incidentOffsets.end() - 1 };
+    for (int slot = 0; slot < static_cast<int>(slotNodes.size()); slot++)
+        incidentSlots[fill[slotNodes[slot]]++] = slot;
+
+    workspace.elementForces.resize(slotNodes.size());
+}
+
 void MeshForceSystem::sendMouseMoved(sf::Vector2f coords)
 {
-    mousePos = coords;
+    sendCommand({ Command::Type::MoveMouse, -1, coords });
 }
 
 void MeshForceSystem::sendKeyPressed(sf::Keyboard::Key key)
 {
+    for (auto const& body : bodies)
+        body.mesh->sendKeyPressed(key);
+
     if (key == sf::Keyboard::G) {
-        gravity = !gravity;
+        sendCommand({ Command::Type::ToggleGravity });
+    } else if (key == sf::Keyboard::M) {
+        auto next { static_cast<Integrator>((static_cast<int>(getIntegrator()) + 1) % integratorCount) };
+        std::cout << "Integrator: " << integratorName(next) << std::endl;
+        setIntegrator(next);
+    } else if (key == sf::Keyboard::B) {
+        auto next { static_cast<BroadPhase>((static_cast<int>(getBroadPhase()) + 1) % broadPhaseCount) };
+        std::cout << "Broad phase: " << broadPhaseName(next) << std::endl;
+        setBroadPhase(next);
     }
 }
 
 void MeshForceSystem::draw(sf::RenderTarget& target, sf::RenderStates states) const
 {
-    if (gravity) {
+    if (showObstacles)
+        target.draw(sf::Sprite{ obstacleTexture }, states);
+
+    for (auto const& body : bodies)
+        target.draw(*body.mesh, states);
+
+    if (snapshots.readBuffer().gravity) {
         // draw ground as a rectangle
         sf::RectangleShape ground { { 1000.f, 10.f } };
         ground.setPosition(0.f, groundLevel);
         ground.setFillColor({ 0, 0, 0, 100 });
         target.draw(ground, states);
     }
+
+    for (auto const& collider : colliders) {
+        sf::VertexArray outline { sf::LineStrip };
+        for (auto point : collider.points)
+            outline.append({ point, { 0, 0, 0, 160 } });
+        if (collider.closed)
+            outline.append({ collider.points.front(), { 0, 0, 0, 160 } });
+        target.draw(outline, states);
+    }
 }
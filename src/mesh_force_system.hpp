@@ -1,26 +1,60 @@
 #ifndef GRAPH_FORCE_SYSTEM_HPP
 #define GRAPH_FORCE_SYSTEM_HPP
 
+#include "aabb_tree.hpp"
+#include "distance_field.hpp"
 #include "mesh.hpp"
+#include "simd_kernels.hpp"
+#include "skyline_cholesky.hpp"
+#include "spatial_hash.hpp"
+#include "spsc_queue.hpp"
+#include "thread_pool.hpp"
+#include "triple_buffer.hpp"
 
 #include <SFML/Graphics.hpp>
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
-#include <unordered_set>
+#include <stop_token>
+#include <thread>
+#include <vector>
 
 class Mesh;
 
 class MeshForceSystem : public Object
 {
 public:
-    MeshForceSystem(std::weak_ptr<Mesh> mesh) :
-        mesh { mesh }
-    {
-    }
+    MeshForceSystem() = default;
+
+    // Copies the latest positions published by the physics thread into
+    // every body's mesh
+    void update(float deltaTime) override;
+
+    // Adds a loaded mesh to the world. The bodies already in it keep their
+    // state; the physics thread is (re)started.
+    void addBody(std::shared_ptr<Mesh> mesh);
+    // Gap kept between a new body and the bodies already in the world
+    static constexpr float bodySpacing = 20.f;
+    int bodyCount() const { return static_cast<int>(bodies.size()); }
+
+    // Stops the physics thread; required before a mesh is modified
+    void stop();
 
-    void update([[maybe_unused]] float deltaTime) override;
-    void reload();
+    // Static geometry the bodies bounce off and slide along, besides the
+    // ground that comes with gravity. A line is solid on its right-hand
+    // side (below a line drawn left to right), up to depth behind it; a
+    // polygon is solid inside. Adding one restarts the physics thread.
+    void addLineCollider(sf::Vector2f a, sf::Vector2f b, float depth = 40.f);
+    void addPolygonCollider(std::vector<sf::Vector2f> points);
+
+    // Replaces the obstacle geometry with the opaque parts of an image,
+    // baked into a distance field. Returns false if it could not be used.
+    bool loadObstacles(std::string const& filename);
+    void openFileDialogAndLoadObstacles();
 
     void sendLeftButtonPressed(sf::Vector2f coords);
     void sendRightButtonPressed(sf::Vector2f coords);
@@ -28,11 +62,113 @@ public:
     void sendMouseMoved(sf::Vector2f coords);
     void sendKeyPressed(sf::Keyboard::Key key);
 
-    float getMomentum();
-    float getAngularMomentum();
+    float getMomentum() const;
+    float getAngularMomentum() const;
+    // Kinetic plus elastic, area and gravity potential energy
+    float getEnergy() const;
+
+    enum class Integrator
+    {
+        RungeKutta4,        // 4 force evaluations per step
+        SymplecticEuler,    // 1 evaluation per step
+        VelocityVerlet,     // 1 evaluation per step, reusing the last one
+        ImplicitEuler,      // 1 evaluation plus a CG solve, at a much larger step
+        Xpbd,               // constraint projection, at the same large step
+        ProjectiveDynamics, // local projections plus a prefactored global solve
+        DormandPrince,      // 6 evaluations per step, step size under error control
+    };
+    static constexpr int integratorCount = 7;
+
+    void setIntegrator(Integrator integrator);
+    Integrator getIntegrator() const;
+    // CG iterations used by the last implicit step
+    int getSolverIterations() const;
+    static const char* integratorName(Integrator integrator);
+
+    // What to do when the steps owed for the elapsed real time do not fit
+    // in the per-tick compute budget
+    enum class OverloadPolicy
+    {
+        SlowMotion,     // drop the excess, letting the simulation fall behind real time
+        LargerSteps,    // stretch the step size (up to maxStepGrowth), then drop;
+                        // projective dynamics always drops, keeping its factored step
+    };
+
+    void setComputeBudget(float secondsPerTick) { computeBudget = secondsPerTick; }
+    void setOverloadPolicy(OverloadPolicy policy) { overloadPolicy = policy; }
+
+    // Steps dropped so far because they did not fit in the compute budget
+    std::uint64_t getDroppedSteps() const;
+    // Steps taken in the most recent physics tick
+    int getLastTickSteps() const;
+
+    // Steps taken by the adaptive integrator in the most recent tick
+    struct StepStatistics
+    {
+        int accepted{};
+        int rejected{};
+        float smallest{};
+        float largest{};
+        float simulated{};
+    };
+    StepStatistics getStepStatistics() const;
+
+    // True while the body is at rest and no steps are being taken
+    bool isSleeping() const;
+
+    // Collision work in the most recent tick; the times should grow
+    // linearly with the number of boundary nodes
+    struct CollisionStatistics
+    {
+        int boundaryNodes{};
+        int boundaryEdges{};
+        int candidates{};
+        int contacts{};
+        int staticContacts{};
+        // Static contacts only the swept test caught
+        int sweptContacts{};
+        float broadPhaseSeconds{};
+        float narrowPhaseSeconds{};
+    };
+    CollisionStatistics getCollisionStatistics() const;
+
+    // How contact candidates are found
+    enum class BroadPhase
+    {
+        HashGrid,           // one spatial hash over every boundary edge, rebuilt each step
+        BoundingVolumes,    // a box tree per body, refit each step and queried pairwise
+    };
+    static constexpr int broadPhaseCount = 2;
+
+    void setBroadPhase(BroadPhase broadPhase);
+    BroadPhase getBroadPhase() const;
+    static const char* broadPhaseName(BroadPhase broadPhase);
+
+    // Number of state buffer allocations so far; constant while stepping
+    std::size_t getStateAllocations() const { return SystemState::allocations; }
 
 private:
-    std::weak_ptr<Mesh> mesh;
+    // Bodies own contiguous ranges of the global node numbering; springs,
+    // triangles and pins below all use global indices
+    struct Body
+    {
+        std::shared_ptr<Mesh> mesh{};
+        int nodeOffset{};
+    };
+
+    std::vector<Body> bodies{};
+
+    // The body a global node index belongs to, and the node itself
+    int bodyOf(int node) const;
+    Nod& nodeAt(int node) const;
+
+    // Rebuilds the global topology from the bodies, resizes the state and
+    // restarts the thread. Nodes below keepCount keep their state and pins.
+    void rebuildWorld(int keepCount);
+    void startPhysics();
+
+    // Everything below up to the render-thread section is owned by the
+    // physics thread while it runs.
 
     bool gravity { false };
     static constexpr float gravityStrength = 2e3f;
@@ -41,7 +177,35 @@ private:
     bool dragging { false };
     int draggedNode { -1 };
 
-    std::unordered_set<int> fixedNodes{};
+    // Pinned nodes as a dense per-node flag plus a compact index list
+    std::vector<std::uint8_t> fixedMask{};
+    std::vector<int> fixedNodes{};
+
+    struct Spring
+    {
+        int a{};
+        int b{};
+        float restLength{};
+        float stiffnessScale{ 1.f };
+    };
+
+    // Springs with at least one free end; rebuilt whenever a pin changes
+    std::vector<Spring> springs{};
+
+    // Every body's edges, triangles and loaded positions
+    std::vector<Mesh::Edge> edges{};
+    std::vector<Mesh::TriangleInfo> triangles{};
+    std::vector<sf::Vector2f> restPositions{};
+
+    // Every spring and triangle writes the forces on its endpoints into
+    // slots of their own (springs first, two slots each, then triangles,
+    // three each). The slots acting on node i are listed in
+    // incidentSlots[incidentOffsets[i]] .. incidentSlots[incidentOffsets[i + 1] - 1].
+    std::vector<int> incidentOffsets{};
+    std::vector<int> incidentSlots{};
+
+    void rebuildSprings();
+    void buildIncidence();
 
     sf::Vector2f mousePos{};
 
@@ -50,36 +214,358 @@ private:
     static constexpr float springConstant = 2e3f;
     static constexpr float dampingConstant = 100.0f;
     static constexpr float airResistance = 1.f;
-    static constexpr float fieldScale = 1e6f;
     static constexpr float areaSpringConstant = 100.f;
 
-    static constexpr float stepSize = 0.00033f;
+    // Limited by the springs alone now that the ground is a contact
+    // rather than a 1/d^2 field
+    static constexpr float stepSize = 0.001f;
+    // Step used by the integrators that stay stable at frame-rate steps,
+    // and the interval the adaptive one covers per call
+    static constexpr float frameStepSize = 1.f / 60.f;
+
+    static constexpr int maxSolverIterations = 40;
+    static constexpr float solverTolerance = 1e-3f;
+    static constexpr int constraintSubsteps = 8;
+    static constexpr int projectiveIterations = 8;
+
+    // Dormand-Prince error control; the error of each component is
+    // measured against absoluteTolerance + relativeTolerance * |value|
+    static constexpr float absoluteTolerance = 1e-3f;
+    static constexpr float relativeTolerance = 1e-4f;
+    static constexpr float minimumAdaptiveStep = stepSize / 10;
+    static constexpr float maximumAdaptiveStep = frameStepSize;
+
+    float baseStepSize() const;
+
+    static constexpr float physicsRate = 60.f;
+
+    // Simulated seconds per real second; matches the former fixed 100
+    // steps of 0.00033 s per 60 Hz frame
+    static constexpr float timeScale = 1.98f;
+    static constexpr float maxStepGrowth = 1.5f;
+
+    std::atomic<float> computeBudget { 0.75f / physicsRate };
+    std::atomic<OverloadPolicy> overloadPolicy { OverloadPolicy::SlowMotion };
+
+    std::uint64_t droppedSteps { 0 };
+
+    // Once every node has stayed below sleepSpeed for sleepDelay simulated
+    // seconds, stepping stops until something disturbs the body
+    static constexpr float sleepSpeed = 2.f;
+    static constexpr float sleepDelay = 1.f;
+
+    bool sleeping { false };
+    float restTime { 0.f };
+
+    void updateSleep(float simulated);
+    void wake();
+
+    // Collisions (collisions.cpp): after every step, boundary nodes are
+    // pushed out to collisionThickness from the boundary edges of every
+    // body, their own included. Edges used by a single triangle form the
+    // boundary; the third corner of that triangle marks the inside.
+    // Edges run with the inside on their left, so every boundary node
+    // starts at least one of them; startSlot is a's place in boundaryNodes.
+    struct BoundaryEdge
+    {
+        int a{};
+        int b{};
+        int inside{};
+        int startSlot{};
+    };
+
+    static constexpr float collisionThickness = 2.f;
+
+    std::vector<int> boundaryNodes{};
+    // Up to two nodes next to each boundary node along the boundary
+    std::vector<std::array<int, 2>> boundaryNeighbors{};
+    std::vector<BoundaryEdge> boundaryEdges{};
+
+    std::vector<SpatialHash::Box> edgeBoxes{};
+    SpatialHash edgeHash{};
+
+    BroadPhase broadPhase { BroadPhase::HashGrid };
+
+    // Boundary edges are grouped by body: body b owns edges
+    // boundaryRanges[b] .. boundaryRanges[b + 1] - 1, and their tree
+    std::vector<int> boundaryRanges{};
+    std::vector<AabbTree> boundaryTrees{};
+
+    // Boundary node (by slot) and edge pairs left for the narrow phase
+    struct Candidate
+    {
+        int slot{};
+        int edge{};
+    };
+    std::vector<Candidate> candidates{};
+
+    CollisionStatistics collisionStatistics{};
+
+    void buildBoundary();
+    // Returns true if any node was moved
+    bool resolveCollisions();
+    // Returns the mean of the longer box sides
+    float updateEdgeBoxes();
+    void findHashCandidates(float cellSize);
+    void findTreeCandidates();
+    void addCandidate(int slot, int k);
+    bool resolveContact(int point, BoundaryEdge const& edge);
+
+    // Static contacts are resolved per node by projection: the node moves
+    // onto the surface, its approaching normal velocity is reflected with
+    // the restitution (only above bounceSpeed, so resting nodes settle)
+    // and its tangential velocity loses up to friction times the normal
+    // change, as Coulomb friction would take.
+    struct StaticCollider
+    {
+        std::vector<sf::Vector2f> points{};
+        bool closed{};
+        float depth{};
+        SpatialHash::Box bounds{};
+    };
+
+    std::vector<StaticCollider> colliders{};
+    DistanceField obstacles{};
+
+    static constexpr float restitution = 0.3f;
+    static constexpr float friction = 0.5f;
+    static constexpr float bounceSpeed = 50.f;
+
+    void addCollider(StaticCollider collider);
+    // Positions at the start of the current step, for the swept test
+    std::vector<sf::Vector2f> stepStart{};
+
+    // Smallest advance of the sphere tracing through the distance field
+    static constexpr float minimumMarch = 0.5f;
+
+    // Returns true if any node was moved
+    bool resolveStaticContacts(float h);
+    // Finds where the move from -> to first enters static geometry, if it
+    // does so in a way the test at the end position gets wrong: passing
+    // through a thin part, or going so deep that the closest way out is
+    // on the far side. The ground, a half-plane, never needs this.
+    bool sweepStaticContact(sf::Vector2f from, sf::Vector2f to, sf::Vector2f& surface, sf::Vector2f& normal) const;
+    void applyStaticContact(int node, sf::Vector2f surface, sf::Vector2f normal, float h);
+
+    // Below these sizes per thread a pass is not worth splitting
+    static constexpr std::size_t elementGrain = 2048;
+    static constexpr std::size_t nodeGrain = 2048;
+
+    class Workspace;
 
     class SystemState
     {
     public:
         SystemState(Mesh::NoduriSSize count, MeshForceSystem const& forceSystem);
 
+        // States are only ever moved, so every buffer allocation goes
+        // through the constructor or resize() and is counted.
+        SystemState(SystemState const&) = delete;
+        SystemState& operator=(SystemState const&) = delete;
+        SystemState(SystemState&&) = default;
+        SystemState& operator=(SystemState&&) = default;
+
+        void resize(Mesh::NoduriSSize newCount);
+        Mesh::NoduriSSize size() const { return count; }
+
+        // Each component is stored as its own contiguous, padded block:
+        // [x...][y...][xDot...][yDot...]
+        float* xs() { return values.data(); }
+        float* ys() { return values.data() + stride; }
+        float* xDots() { return values.data() + 2 * stride; }
+        float* yDots() { return values.data() + 3 * stride; }
+
+        const float* xs() const { return values.data(); }
+        const float* ys() const { return values.data() + stride; }
+        const float* xDots() const { return values.data() + 2 * stride; }
+        const float* yDots() const { return values.data() + 3 * stride; }
+
         float& x(int index);
         float& y(int index);
         float& xDot(int index);
         float& yDot(int index);
 
-        void next(Mesh const& mesh);
+        float x(int index) const;
+        float y(int index) const;
+        float xDot(int index) const;
+        float yDot(int index) const;
+
+        // Advances the state by h with the given scheme (integrators.cpp)
+        void next(Workspace& workspace, float h, Integrator integrator);
+
+        // Computes the projective dynamics rest shapes from the loaded
+        // positions and factors its system (projective_dynamics.cpp)
+        void prepareProjective(Workspace& workspace, float h) const;
+
+        static inline std::atomic<std::size_t> allocations { 0 };
 
     private:
-        SystemState getDiffs(Mesh const& mesh);
+        void getDiffs(SystemState& diffs, Workspace& workspace) const;
+
+        void stepRungeKutta4(Workspace& workspace, float h);
+        void stepSymplecticEuler(Workspace& workspace, float h);
+        void stepVelocityVerlet(Workspace& workspace, float h);
+        void stepImplicitEuler(Workspace& workspace, float h);
+        void stepXpbd(Workspace& workspace, float h);
+        void stepProjectiveDynamics(Workspace& workspace, float h);
+        void stepDormandPrince(Workspace& workspace, float h);
+        // One accepted step of at most maxStep; returns its length
+        float adaptiveStep(Workspace& workspace, float maxStep);
+
+        void factorProjective(Workspace& workspace, float h) const;
+
+        // Implicit Euler helpers (implicit_euler.cpp)
+        void linearize(Workspace& workspace, float h) const;
+        void applyJacobians(
+            Workspace& workspace,
+            const float* p, float* out,
+            float identityScale, float dampingScale, float stiffnessScale
+        ) const;
+
+        // Positions [x...][y...] and velocities [xDot...][yDot...] as two
+        // blocks of 2 * stride floats each
+        float* positions() { return values.data(); }
+        float* velocities() { return values.data() + 2 * stride; }
+        const float* positions() const { return values.data(); }
+        const float* velocities() const { return values.data() + 2 * stride; }
 
         Mesh::NoduriSSize count;
-        std::vector<float> values;
+        std::size_t stride;
+        Simd::AlignedFloats values;
 
         std::reference_wrapper<MeshForceSystem const> forceSystem;
     };
 
-    SystemState state{mesh.lock()->nodeCount(), *this};
+    // Buffers reused by every step, sized by rebuildWorld()
+    class Workspace
+    {
+    public:
+        Workspace(Mesh::NoduriSSize count, MeshForceSystem const& forceSystem);
+
+        void resize(Mesh::NoduriSSize count);
+
+    private:
+        void resizeSolver(Mesh::NoduriSSize count);
+
+        ThreadPool pool{};
+        std::vector<sf::Vector2f> elementForces{};
+
+        SystemState k1;
+        SystemState k2;
+        SystemState k3;
+        SystemState k4;
+        SystemState k5;
+        SystemState k6;
+        SystemState k7;
+        SystemState scratch;
+
+        // Velocity Verlet and Dormand-Prince keep the derivatives at the
+        // current state in k1 between steps; anything that changes the
+        // forces clears this.
+        bool derivativesCached{ false };
+
+        // Step size the error controller proposes next, and what it did
+        // since the last snapshot
+        float proposedStep{ stepSize };
+        StepStatistics stepStatistics{};
+
+        // Force Jacobians linearized at the start of an implicit step.
+        // Springs store their direction and stiffness split along and across
+        // it; triangles store their area gradients.
+        struct SpringJacobian
+        {
+            sf::Vector2f direction{};
+            float axialStiffness{};
+            float lateralStiffness{};
+            float damping{};
+        };
+
+        std::vector<SpringJacobian> springJacobians{};
+        std::vector<std::array<sf::Vector2f, 3>> areaGradients{};
+
+        // Conjugate gradient vectors over all velocities ([x...][y...])
+        Simd::AlignedFloats deltaV{};
+        Simd::AlignedFloats residual{};
+        Simd::AlignedFloats preconditioned{};
+        Simd::AlignedFloats direction{};
+        Simd::AlignedFloats product{};
+        Simd::AlignedFloats inverseDiagonal{};
+
+        int solverIterations{ 0 };
+
+        // XPBD multipliers, springs first, then triangles
+        std::vector<float> constraintLambdas{};
+
+        // Projective dynamics: inverse rest edge matrix of each triangle and
+        // the global system, factored for one step size and set of pins.
+        // A step size of 0 marks the factorization as stale.
+        std::vector<std::array<float, 4>> inverseRestShapes{};
+        SkylineCholesky projectiveSystem{};
+        float projectiveStepSize{ 0.f };
+        std::vector<double> solveWork[2]{};
+
+        friend SystemState;
+        friend MeshForceSystem;
+    };
+
+    SystemState state{0, *this};
+    Workspace workspace{0, *this};
 
     friend SystemState;
 
+    Integrator integrator { Integrator::RungeKutta4 };
+
+    float computeMomentum() const;
+    float computeAngularMomentum() const;
+    float computeEnergy() const;
+
+    // Mouse and keyboard input, forwarded from the render thread
+    struct Command
+    {
+        enum class Type { Grab, MoveMouse, Release, TogglePin, ToggleGravity, SetIntegrator, SetBroadPhase };
+
+        Type type{};
+        int node{ -1 };
+        sf::Vector2f coords{};
+        Integrator integrator{};
+        BroadPhase broadPhase{};
+    };
+
+    // What the render thread sees of the simulation
+    struct Snapshot
+    {
+        std::vector<sf::Vector2f> positions{};
+        float momentum{};
+        float angularMomentum{};
+        float energy{};
+        bool gravity{};
+        Integrator integrator{};
+        std::uint64_t droppedSteps{};
+        int lastTickSteps{};
+        int solverIterations{};
+        StepStatistics stepStatistics{};
+        bool sleeping{};
+        CollisionStatistics collisionStatistics{};
+        BroadPhase broadPhase{};
+    };
+
+    SpscQueue<Command, 1024> commands{};
+    TripleBuffer<Snapshot> snapshots{};
+
+    void sendCommand(Command const& command);
+    void applyCommand(Command const& command);
+    void publishSnapshot(int lastTickSteps);
+    void runPhysics(std::stop_token stopToken);
+
+    // Render thread
+    int highlightedNode { -1 };
+    std::vector<std::uint8_t> shownPins{};
+    sf::Texture obstacleTexture{};
+    bool showObstacles { false };
+
+    // Declared last so it is joined before the state it uses is destroyed
+    std::jthread physicsThread{};
+
     virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
 };
 
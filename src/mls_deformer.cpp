@@ -0,0 +1,244 @@
+#include "mls_deformer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+namespace
+{
+
+// Control points binned into a uniform grid with a couple of points per
+// cell. The nearest points to a query are collected ring by ring around
+// its cell, until the next ring cannot hold anything closer.
+class PointGrid
+{
+public:
+    explicit PointGrid(std::vector<sf::Vector2f> const& source)
+        : points{source}
+    {
+        origin = upper = points.empty() ? sf::Vector2f{} : points[0];
+        for (auto const& p : points) {
+            origin = { std::min(origin.x, p.x), std::min(origin.y, p.y) };
+            upper = { std::max(upper.x, p.x), std::max(upper.y, p.y) };
+        }
+
+        auto extent { upper - origin };
+        auto area { std::max(extent.x * extent.y, 1.f) };
+        cellSize = std::max(std::sqrt(2.f * area / std::max<std::size_t>(points.size(), 1)), 1e-3f);
+        columns = static_cast<int>(extent.x / cellSize) + 1;
+        rows = static_cast<int>(extent.y / cellSize) + 1;
+
+        cellStart.assign(static_cast<std::size_t>(columns) * rows + 1, 0);
+        for (auto const& p : points)
+            cellStart[cellOf(p) + 1]++;
+        std::partial_sum(cellStart.begin(), cellStart.end(), cellStart.begin());
+
+        auto fill { cellStart };
+        cellPoints.resize(points.size());
+        for (std::size_t i = 0; i < points.size(); i++)
+            cellPoints[fill[cellOf(points[i])]++] = static_cast<int>(i);
+    }
+
+    void nearest(sf::Vector2f query, std::size_t count, std::vector<int>& out) const
+    {
+        // Max-heap on distance, so the farthest kept point is on top
+        std::vector<std::pair<float, int>> heap{};
+        count = std::min(count, points.size());
+
+        auto cx { column(query.x) };
+        auto cy { row(query.y) };
+
+        for (int ring = 0; ring <= std::max(columns, rows); ring++) {
+            // Cells of this ring are at least ring - 1 cells away from the
+            // query, which is in (or clamped to) the center cell
+            auto reach { std::max(ring - 1, 0) * cellSize };
+            if (heap.size() == count && heap.front().first <= reach * reach)
+                break;
+
+            for (int y = cy - ring; y <= cy + ring; y++) {
+                if (y < 0 || y >= rows)
+                    continue;
+
+                // Inner rows of the ring only have their two ends
+                auto step { y == cy - ring || y == cy + ring ? 1 : 2 * ring };
+                for (int x = cx - ring; x <= cx + ring; x += step) {
+                    if (x < 0 || x >= columns)
+                        continue;
+
+                    auto cell { static_cast<std::size_t>(y) * columns + x };
+                    for (auto k { cellStart[cell] }; k < cellStart[cell + 1]; k++) {
+                        auto i { cellPoints[k] };
+                        auto d { points[i] - query };
+                        auto distance { d.x * d.x + d.y * d.y };
+
+                        if (heap.size() < count) {
+                            heap.push_back({ distance, i });
+                            std::push_heap(heap.begin(), heap.end());
+                        } else if (distance < heap.front().first) {
+                            std::pop_heap(heap.begin(), heap.end());
+                            heap.back() = { distance, i };
+                            std::push_heap(heap.begin(), heap.end());
+                        }
+                    }
+                }
+            }
+        }
+
+        out.clear();
+        for (auto const& [distance, i] : heap)
+            out.push_back(i);
+        // Summing in index order keeps the result independent of the heap
+        std::sort(out.begin(), out.end());
+    }
+
+private:
+    int column(float x) const { return std::clamp(static_cast<int>((x - origin.x) / cellSize), 0, columns - 1); }
+    int row(float y) const { return std::clamp(static_cast<int>((y - origin.y) / cellSize), 0, rows - 1); }
+    std::size_t cellOf(sf::Vector2f p) const { return static_cast<std::size_t>(row(p.y)) * columns + column(p.x); }
+
+    std::vector<sf::Vector2f> points{};
+    sf::Vector2f origin{};
+    sf::Vector2f upper{};
+    float cellSize{ 1.f };
+    int columns{ 1 };
+    int rows{ 1 };
+
+    // Points of cell c are cellPoints[cellStart[c]] .. cellPoints[cellStart[c + 1] - 1]
+    std::vector<int> cellStart{};
+    std::vector<int> cellPoints{};
+};
+
+}
+
+// Appends the terms of rest point v over the chosen control points
+template<typename Term>
+static void appendTerms(
+    std::vector<sf::Vector2f> const& controlPoints,
+    std::vector<int> const& chosen,
+    sf::Vector2f v,
+    std::vector<double>& weights,
+    std::vector<Term>& terms
+) {
+    constexpr double epsilon = 1e-8;
+    weights.resize(chosen.size());
+
+    // The sums cancel heavily next to a control point, so they run in double
+    double weightSum { 0.0 };
+    double starX { 0.0 };
+    double starY { 0.0 };
+
+    for (std::size_t k = 0; k < chosen.size(); k++) {
+        auto const& p { controlPoints[chosen[k]] };
+        double dx { p.x - v.x };
+        double dy { p.y - v.y };
+        weights[k] = 1.0 / std::max(dx * dx + dy * dy, epsilon);
+        weightSum += weights[k];
+        starX += weights[k] * p.x;
+        starY += weights[k] * p.y;
+    }
+
+    starX /= weightSum;
+    starY /= weightSum;
+
+    double mu { 0.0 };
+    for (std::size_t k = 0; k < chosen.size(); k++) {
+        auto const& p { controlPoints[chosen[k]] };
+        double hatX { p.x - starX };
+        double hatY { p.y - starY };
+        mu += weights[k] * (hatX * hatX + hatY * hatY);
+    }
+
+    // q* enters through the weighted centroid only: the rotations of the
+    // centered points sum to zero, since sum w_i p^_i does
+    double vx { v.x - starX };
+    double vy { v.y - starY };
+
+    for (std::size_t k = 0; k < chosen.size(); k++) {
+        auto const& p { controlPoints[chosen[k]] };
+        double hatX { p.x - starX };
+        double hatY { p.y - starY };
+        auto scale { mu > 0.0 ? weights[k] / mu : 0.0 };
+
+        terms.push_back({
+            chosen[k],
+            static_cast<float>(weights[k] / weightSum + scale * (hatX * vx + hatY * vy)),
+            static_cast<float>(scale * (hatY * vx - hatX * vy))
+        });
+    }
+}
+
+template<typename Term>
+static sf::Vector2f evaluate(Term const* begin, Term const* end, std::vector<sf::Vector2f> const& displaced)
+{
+    sf::Vector2f result { 0.f, 0.f };
+    for (auto term { begin }; term != end; term++) {
+        auto q { displaced[term->control] };
+        result.x += term->alpha * q.x + term->beta * q.y;
+        result.y += term->alpha * q.y - term->beta * q.x;
+    }
+    return result;
+}
+
+void MlsDeformer::build(std::vector<sf::Vector2f> const& controlPoints, std::vector<sf::Vector2f> const& restPoints, int neighbors)
+{
+    this->controlPoints = controlPoints;
+    this->restPoints = restPoints;
+    this->neighbors = neighbors;
+
+    auto truncated { neighbors > 0 && static_cast<std::size_t>(neighbors) < controlPoints.size() };
+    auto perPoint { truncated ? static_cast<std::size_t>(neighbors) : controlPoints.size() };
+
+    offsets.assign(1, 0);
+    terms.clear();
+    terms.reserve(restPoints.size() * perPoint);
+
+    std::vector<int> chosen(controlPoints.size());
+    std::iota(chosen.begin(), chosen.end(), 0);
+    std::vector<double> weights{};
+    PointGrid grid { truncated ? controlPoints : std::vector<sf::Vector2f>{} };
+
+    for (auto const& v : restPoints) {
+        if (truncated)
+            grid.nearest(v, perPoint, chosen);
+
+        appendTerms(controlPoints, chosen, v, weights, terms);
+        offsets.push_back(static_cast<int>(terms.size()));
+    }
+}
+
+void MlsDeformer::apply(std::vector<sf::Vector2f> const& displaced, std::vector<sf::Vector2f>& out) const
+{
+    out.resize(pointCount());
+
+    for (std::size_t k = 0; k < out.size(); k++)
+        out[k] = evaluate(terms.data() + offsets[k], terms.data() + offsets[k + 1], displaced);
+}
+
+MlsDeformer::Error MlsDeformer::truncationError(std::vector<sf::Vector2f> const& displaced) const
+{
+    Error error{};
+    if (pointCount() == 0)
+        return error;
+
+    std::vector<int> all(controlPoints.size());
+    std::iota(all.begin(), all.end(), 0);
+    std::vector<double> weights{};
+    std::vector<Term> full{};
+    double sum { 0.0 };
+
+    for (std::size_t k = 0; k < pointCount(); k++) {
+        full.clear();
+        appendTerms(controlPoints, all, restPoints[k], weights, full);
+
+        auto exact { evaluate(full.data(), full.data() + full.size(), displaced) };
+        auto approximate { evaluate(terms.data() + offsets[k], terms.data() + offsets[k + 1], displaced) };
+        auto distance { std::hypot(exact.x - approximate.x, exact.y - approximate.y) };
+
+        error.max = std::max(error.max, distance);
+        sum += distance;
+    }
+
+    error.mean = static_cast<float>(sum / pointCount());
+    return error;
+}
@@ -0,0 +1,62 @@
+#ifndef MLS_DEFORMER_HPP
+#define MLS_DEFORMER_HPP
+
+#include <SFML/System/Vector2.hpp>
+
+#include <vector>
+
+// Moving least squares deformation (Schaefer et al.) of a fixed set of rest
+// points by control points whose rest positions are fixed too. Normalized
+// by mu, the deformed position of a rest point is linear in the displaced
+// control points, each contributing a scaled rotation of itself:
+//
+//     f(v) = sum_i [alpha_i  beta_i; -beta_i  alpha_i] q_i
+//
+// The weights, centroids and mu only depend on the rest pose, so they are
+// folded into (alpha, beta) once and a warp is one pass over the terms.
+//
+// Inverse-square weights make far control points negligible, so the sum
+// can be truncated to the nearest ones. The truncated map is still a
+// moving least squares fit, only over fewer points, so it reproduces
+// rigid motions exactly; the error shows under deformation.
+class MlsDeformer
+{
+public:
+    // neighbors = 0 sums over every control point
+    void build(std::vector<sf::Vector2f> const& controlPoints, std::vector<sf::Vector2f> const& restPoints, int neighbors = 0);
+
+    std::size_t pointCount() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    int neighborCount() const { return neighbors; }
+
+    // out receives the deformed rest points, in the order they were given
+    void apply(std::vector<sf::Vector2f> const& displaced, std::vector<sf::Vector2f>& out) const;
+
+    struct Error
+    {
+        float max{};
+        float mean{};
+    };
+
+    // How far apply() lands from the sum over every control point, for the
+    // given displaced control points. Evaluates the full sum, so it is a
+    // diagnostic and not for every frame.
+    Error truncationError(std::vector<sf::Vector2f> const& displaced) const;
+
+private:
+    struct Term
+    {
+        int control{};
+        float alpha{};
+        float beta{};
+    };
+
+    int neighbors{ 0 };
+    std::vector<sf::Vector2f> controlPoints{};
+    std::vector<sf::Vector2f> restPoints{};
+
+    // The terms of rest point k are terms[offsets[k]] .. terms[offsets[k + 1] - 1]
+    std::vector<int> offsets{};
+    std::vector<Term> terms{};
+};
+
+#endif // MLS_DEFORMER_HPP
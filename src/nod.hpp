@@ -29,6 +29,12 @@ public:
 
     sf::Vector2f getPosition() const { return position; }
 
+    // Current look, for drawing many nodes as one batch
+    sf::Color fillColor() const { return currentColor; }
+    sf::Color outlineColor() const { return currentOutlineColor; }
+    float outlineThickness() const { return currentOutlineThickness; }
+    static constexpr float radius() { return circleRadius; }
+
     bool hitInside(sf::Vector2f coords) const;
 
 private:
@@ -0,0 +1,285 @@
+#include "mesh_force_system.hpp"
+
+#include "simd_kernels.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Projective dynamics (Bouaziz et al.): every step alternates a local step,
+// projecting each edge onto its rest length and each triangle onto the
+// closest rotation of its rest shape, with a global step solving
+//
+//     (M / h^2 + sum w A^T A) x = M / h^2 s + sum w A^T p
+//
+// for both coordinates, where s is the inertial prediction. The matrix only
+// depends on the topology, the pins and h, so it is factored once and each
+// iteration is two back-substitutions. Pinned nodes are eliminated: their
+// rows become the identity and their couplings move to the right side.
+//
+// Triangle weights are areaSpringConstant * restArea^2, which matches the
+// small-strain stiffness of the area springs of the force model.
+//
+// Spring damping is implicit too, in Rayleigh form: D = sum c A^T A with
+// the spring damping constants. Backward Euler on -D v with v = (x - x_n) / h
+// adds D / h to the matrix and h D x_n to the prediction. That damps motion
+// across a spring as well, rotations included, so the across part is handed
+// back as an explicit force at the start velocities. Motion across a spring
+// then keeps its speed, and only motion along it is damped, as in the force
+// model.
+
+// Gradients of the deformation gradient with respect to the three corners;
+// F = sum_j p_j d_j^T, one row per coordinate
+static std::array<sf::Vector2f, 3> shapeGradients(std::array<float, 4> const& inverseRest)
+{
+    sf::Vector2f b { inverseRest[0], inverseRest[1] };
+    sf::Vector2f c { inverseRest[2], inverseRest[3] };
+    return { -b - c, b, c };
+}
+
+static float dot(sf::Vector2f a, sf::Vector2f b)
+{
+    return a.x * b.x + a.y * b.y;
+}
+
+void MeshForceSystem::SystemState::prepareProjective(Workspace& workspace, float h) const
+{
+    auto const& system { forceSystem.get() };
+    auto const& triangles { system.triangles };
+    auto const& rest { system.restPositions };
+    workspace.inverseRestShapes.resize(triangles.size());
+
+    for (std::size_t k = 0; k < triangles.size(); k++) {
+        auto const& tri { triangles[k] };
+        auto e1 { rest[tri.b] - rest[tri.a] };
+        auto e2 { rest[tri.c] - rest[tri.a] };
+        auto det { e1.x * e2.y - e2.x * e1.y };
+
+        // Degenerate triangles get no shape constraint
+        if (std::fabs(det) < 1e-6f) {
+            workspace.inverseRestShapes[k] = { 0.f, 0.f, 0.f, 0.f };
+            continue;
+        }
+
+        workspace.inverseRestShapes[k] = { e2.y / det, -e2.x / det, -e1.y / det, e1.x / det };
+    }
+
+    factorProjective(workspace, h);
+}
+
+void MeshForceSystem::SystemState::factorProjective(Workspace& workspace, float h) const
+{
+    auto const& system { forceSystem.get() };
+    auto const& triangles { system.triangles };
+    auto const& fixedMask { system.fixedMask };
+
+    std::vector<SkylineCholesky::Entry> entries{};
+    entries.reserve(count + system.springs.size() * 3 + triangles.size() * 6);
+
+    for (int i = 0; i < count; i++)
+        entries.push_back({ i, i, fixedMask[i] ? 1.0 : 1.0 / (static_cast<double>(h) * h) });
+
+    for (auto const& spring : system.springs) {
+        double weight { springConstant * spring.stiffnessScale + dampingConstant * spring.stiffnessScale / h };
+        if (!fixedMask[spring.a])
+            entries.push_back({ spring.a, spring.a, weight });
+        if (!fixedMask[spring.b])
+            entries.push_back({ spring.b, spring.b, weight });
+        if (!fixedMask[spring.a] && !fixedMask[spring.b])
+            entries.push_back({ spring.a, spring.b, -weight });
+    }
+
+    for (std::size_t k = 0; k < triangles.size(); k++) {
+        auto const& tri { triangles[k] };
+        int nodes[3] { tri.a, tri.b, tri.c };
+        auto gradients { shapeGradients(workspace.inverseRestShapes[k]) };
+        double weight { areaSpringConstant * tri.restSignedArea * tri.restSignedArea };
+
+        for (int j = 0; j < 3; j++) {
+            for (int l = j; l < 3; l++) {
+                if (!fixedMask[nodes[j]] && !fixedMask[nodes[l]])
+                    entries.push_back({ nodes[j], nodes[l], weight * dot(gradients[j], gradients[l]) });
+            }
+        }
+    }
+
+    workspace.projectiveSystem.factor(count, entries);
+    workspace.projectiveStepSize = h;
+}
+
+void MeshForceSystem::SystemState::stepProjectiveDynamics(Workspace& workspace, float h)
+{
+    auto const& system { forceSystem.get() };
+    auto const& springs { system.springs };
+    auto const& triangles { system.triangles };
+    auto const& fixedMask { system.fixedMask };
+    auto& elementForces { workspace.elementForces };
+    auto triangleSlots { springs.size() * 2 };
+
+    if (workspace.projectiveStepSize != h)
+        factorProjective(workspace, h);
+
+    // Only happens for meshes the factorization cannot handle at all
+    if (workspace.projectiveSystem.size() != count) {
+        stepImplicitEuler(workspace, h);
+        return;
+    }
+
+    auto& external { workspace.k1 };
+    auto& previous { workspace.k2 };
+    auto& rhs { workspace.k3 };
+    auto& target { workspace.scratch };
+    auto half { stride * 2 };
+
+    Simd::NodeForceParams nodeParams {
+        airResistance,
+        system.gravity,
+        gravityStrength
+    };
+
+    Simd::nodeForces(external.xDots(), external.yDots(), xDots(), yDots(), nodeParams, count);
+
+    // Forces outside the prefactored matrix are explicit, except for the
+    // stiff mouse spring. The dragged node takes a linearized backward
+    // Euler step of its own, a = (f - h K v) / (1 + h D + h^2 K).
+    if (system.dragging && system.draggedNode != -1) {
+        auto i { system.draggedNode };
+        sf::Vector2f delta { x(i) - system.mousePos.x, y(i) - system.mousePos.y };
+        auto length { Util::distance({ x(i), y(i) }, system.mousePos) + 0.01f };
+        auto n { delta / length };
+        sf::Vector2f force { external.xDot(i), external.yDot(i) };
+        force += -springConstant * 2 * delta - dampingConstant * dot({ xDot(i), yDot(i) }, n) * n;
+        auto stiffness { springConstant * 2 };
+        auto denominator { 1.f + h * dampingConstant + h * h * stiffness };
+
+        external.xDot(i) = (force.x - h * stiffness * xDot(i)) / denominator;
+        external.yDot(i) = (force.y - h * stiffness * yDot(i)) / denominator;
+    }
+
+    for (auto i : system.fixedNodes)
+        external.xDot(i) = external.yDot(i) = 0.f;
+
+    std::copy_n(positions(), half, previous.positions());
+    Simd::axpy(target.positions(), positions(), h, velocities(), half);
+    Simd::axpy(target.positions(), target.positions(), h * h, external.velocities(), half);
+
+    // The damping part of the prediction, h D x_n with the couplings to
+    // pinned nodes left out as in the matrix, plus the damping across each
+    // spring handed back at the start velocities
+    workspace.pool.parallelFor(springs.size() + triangles.size(), elementGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto k { begin }; k < std::min(end, springs.size()); k++) {
+            auto const& spring { springs[k] };
+            auto damping { dampingConstant * spring.stiffnessScale };
+            sf::Vector2f a { x(spring.a), y(spring.a) };
+            sf::Vector2f b { x(spring.b), y(spring.b) };
+            auto n { (a - b) / std::max(Util::distance(a, b), 1e-6f) };
+            sf::Vector2f relative { xDot(spring.a) - xDot(spring.b), yDot(spring.a) - yDot(spring.b) };
+            auto across { h * h * damping * (relative - dot(relative, n) * n) };
+
+            elementForces[2 * k] = h * damping * (a - (fixedMask[spring.b] ? sf::Vector2f{} : b)) + across;
+            elementForces[2 * k + 1] = h * damping * (b - (fixedMask[spring.a] ? sf::Vector2f{} : a)) - across;
+        }
+
+        for (auto k { std::max(begin, springs.size()) }; k < end; k++) {
+            auto slot { triangleSlots + 3 * (k - springs.size()) };
+            for (int j = 0; j < 3; j++)
+                elementForces[slot + j] = {};
+        }
+    });
+
+    workspace.pool.parallelFor(count, nodeGrain, [&](std::size_t begin, std::size_t end) {
+        for (auto i { begin }; i < end; i++) {
+            if (fixedMask[i])
+                continue;
+
+            sf::Vector2f value{};
+            for (int k = system.incidentOffsets[i]; k < system.incidentOffsets[i + 1]; k++)
+                value += elementForces[system.incidentSlots[k]];
+
+            target.x(i) += value.x;
+            target.y(i) += value.y;
+        }
+    });
+
+    std::copy_n(target.positions(), half, positions());
+
+    auto inertia { 1.f / (h * h) };
+
+    for (int iteration = 0; iteration < projectiveIterations; iteration++) {
+        // Local step: each element writes w A^T p for its nodes into its
+        // own slots, plus the couplings to pinned nodes it removed from the
+        // matrix
+        workspace.pool.parallelFor(springs.size() + triangles.size(), elementGrain, [&](std::size_t begin, std::size_t end) {
+            for (auto k { begin }; k < std::min(end, springs.size()); k++) {
+                auto const& spring { springs[k] };
+                auto weight { springConstant * spring.stiffnessScale };
+                sf::Vector2f a { x(spring.a), y(spring.a) };
+                sf::Vector2f b { x(spring.b), y(spring.b) };
+                auto length { std::max(Util::distance(a, b), 1e-6f) };
+                auto projected { weight * spring.restLength / length * (a - b) };
+
+                elementForces[2 * k] = projected + (fixedMask[spring.b] ? weight * b : sf::Vector2f{});
+                elementForces[2 * k + 1] = -projected + (fixedMask[spring.a] ? weight * a : sf::Vector2f{});
+            }
+
+            for (auto k { std::max(begin, springs.size()) }; k < end; k++) {
+                auto const& tri { triangles[k - springs.size()] };
+                int nodes[3] { tri.a, tri.b, tri.c };
+                auto gradients { shapeGradients(workspace.inverseRestShapes[k - springs.size()]) };
+                auto weight { areaSpringConstant * tri.restSignedArea * tri.restSignedArea };
+
+                // Deformation gradient and its closest rotation
+                float f00 { 0.f }, f01 { 0.f }, f10 { 0.f }, f11 { 0.f };
+                for (int j = 0; j < 3; j++) {
+                    f00 += x(nodes[j]) * gradients[j].x;
+                    f01 += x(nodes[j]) * gradients[j].y;
+                    f10 += y(nodes[j]) * gradients[j].x;
+                    f11 += y(nodes[j]) * gradients[j].y;
+                }
+
+                auto angle { std::atan2(f10 - f01, f00 + f11) };
+                sf::Vector2f rowX { std::cos(angle), -std::sin(angle) };
+                sf::Vector2f rowY { std::sin(angle), std::cos(angle) };
+
+                auto slot { triangleSlots + 3 * (k - springs.size()) };
+                for (int j = 0; j < 3; j++) {
+                    sf::Vector2f value { weight * dot(gradients[j], rowX), weight * dot(gradients[j], rowY) };
+                    for (int l = 0; l < 3; l++) {
+                        if (l != j && fixedMask[nodes[l]])
+                            value -= weight * dot(gradients[j], gradients[l]) * sf::Vector2f{ x(nodes[l]), y(nodes[l]) };
+                    }
+                    elementForces[slot + j] = value;
+                }
+            }
+        });
+
+        workspace.pool.parallelFor(count, nodeGrain, [&](std::size_t begin, std::size_t end) {
+            for (auto i { begin }; i < end; i++) {
+                if (fixedMask[i]) {
+                    rhs.x(i) = x(i);
+                    rhs.y(i) = y(i);
+                    continue;
+                }
+
+                sf::Vector2f value { inertia * target.x(i), inertia * target.y(i) };
+                for (int k = system.incidentOffsets[i]; k < system.incidentOffsets[i + 1]; k++)
+                    value += elementForces[system.incidentSlots[k]];
+
+                rhs.x(i) = value.x;
+                rhs.y(i) = value.y;
+            }
+        });
+
+        // Global step: x and y share the matrix and solve independently
+        workspace.pool.parallelFor(2, 1, [&](std::size_t begin, std::size_t end) {
+            for (auto c { begin }; c < end; c++)
+                workspace.projectiveSystem.solve(c == 0 ? rhs.xs() : rhs.ys(), workspace.solveWork[c]);
+        });
+
+        std::copy_n(rhs.xs(), count, xs());
+        std::copy_n(rhs.ys(), count, ys());
+    }
+
+    for (std::size_t i = 0; i < half; i++)
+        velocities()[i] = (positions()[i] - previous.positions()[i]) / h;
+}
@@ -0,0 +1,218 @@
+#include "simd_kernels.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    void axpyScalar(float* out, const float* a, float scale, const float* b, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+            out[i] = a[i] + scale * b[i];
+    }
+
+    void rk4CombineScalar(
+        float* values,
+        const float* k1, const float* k2, const float* k3, const float* k4,
+        float scale, std::size_t count
+    ) {
+        for (std::size_t i = 0; i < count; i++)
+            values[i] += scale * (k1[i] + 2.f * k2[i] + 2.f * k3[i] + k4[i]);
+    }
+
+    void nodeForcesScalar(
+        float* xDotDiff, float* yDotDiff,
+        const float* xDot, const float* yDot,
+        const Simd::NodeForceParams& params, std::size_t begin, std::size_t end
+    ) {
+        auto gravity { params.gravity ? params.gravityStrength : 0.f };
+
+        for (std::size_t i = begin; i < end; i++) {
+            xDotDiff[i] = -params.airResistance * xDot[i];
+            yDotDiff[i] = -params.airResistance * yDot[i] + gravity;
+        }
+    }
+
+#ifdef SIMD_KERNELS_X86
+    __attribute__((target("avx2,fma")))
+    void axpyAvx2(float* out, const float* a, float scale, const float* b, std::size_t count)
+    {
+        auto s { _mm256_set1_ps(scale) };
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(s, _mm256_loadu_ps(b + i), _mm256_loadu_ps(a + i)));
+        axpyScalar(out + i, a + i, scale, b + i, count - i);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void rk4CombineAvx2(
+        float* values,
+        const float* k1, const float* k2, const float* k3, const float* k4,
+        float scale, std::size_t count
+    ) {
+        auto s { _mm256_set1_ps(scale) };
+        auto two { _mm256_set1_ps(2.f) };
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            auto middle { _mm256_add_ps(_mm256_loadu_ps(k2 + i), _mm256_loadu_ps(k3 + i)) };
+            auto ends { _mm256_add_ps(_mm256_loadu_ps(k1 + i), _mm256_loadu_ps(k4 + i)) };
+            auto sum { _mm256_fmadd_ps(two, middle, ends) };
+            _mm256_storeu_ps(values + i, _mm256_fmadd_ps(s, sum, _mm256_loadu_ps(values + i)));
+        }
+        rk4CombineScalar(values + i, k1 + i, k2 + i, k3 + i, k4 + i, scale, count - i);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void nodeForcesAvx2(
+        float* xDotDiff, float* yDotDiff,
+        const float* xDot, const float* yDot,
+        const Simd::NodeForceParams& params, std::size_t count
+    ) {
+        auto negAir { _mm256_set1_ps(-params.airResistance) };
+        auto gravity { _mm256_set1_ps(params.gravity ? params.gravityStrength : 0.f) };
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(xDotDiff + i, _mm256_mul_ps(negAir, _mm256_loadu_ps(xDot + i)));
+            _mm256_storeu_ps(yDotDiff + i, _mm256_add_ps(_mm256_mul_ps(negAir, _mm256_loadu_ps(yDot + i)), gravity));
+        }
+        nodeForcesScalar(xDotDiff, yDotDiff, xDot, yDot, params, i, count);
+    }
+
+    void axpySse(float* out, const float* a, float scale, const float* b, std::size_t count)
+    {
+        auto s { _mm_set1_ps(scale) };
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_mul_ps(s, _mm_loadu_ps(b + i))));
+        axpyScalar(out + i, a + i, scale, b + i, count - i);
+    }
+
+    void rk4CombineSse(
+        float* values,
+        const float* k1, const float* k2, const float* k3, const float* k4,
+        float scale, std::size_t count
+    ) {
+        auto s { _mm_set1_ps(scale) };
+        auto two { _mm_set1_ps(2.f) };
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            auto middle { _mm_add_ps(_mm_loadu_ps(k2 + i), _mm_loadu_ps(k3 + i)) };
+            auto ends { _mm_add_ps(_mm_loadu_ps(k1 + i), _mm_loadu_ps(k4 + i)) };
+            auto sum { _mm_add_ps(_mm_mul_ps(two, middle), ends) };
+            _mm_storeu_ps(values + i, _mm_add_ps(_mm_loadu_ps(values + i), _mm_mul_ps(s, sum)));
+        }
+        rk4CombineScalar(values + i, k1 + i, k2 + i, k3 + i, k4 + i, scale, count - i);
+    }
+
+    void nodeForcesSse(
+        float* xDotDiff, float* yDotDiff,
+        const float* xDot, const float* yDot,
+        const Simd::NodeForceParams& params, std::size_t count
+    ) {
+        auto negAir { _mm_set1_ps(-params.airResistance) };
+        auto gravity { _mm_set1_ps(params.gravity ? params.gravityStrength : 0.f) };
+
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(xDotDiff + i, _mm_mul_ps(negAir, _mm_loadu_ps(xDot + i)));
+            _mm_storeu_ps(yDotDiff + i, _mm_add_ps(_mm_mul_ps(negAir, _mm_loadu_ps(yDot + i)), gravity));
+        }
+        nodeForcesScalar(xDotDiff, yDotDiff, xDot, yDot, params, i, count);
+    }
+#endif
+
+    void nodeForcesScalarAll(
+        float* xDotDiff, float* yDotDiff,
+        const float* xDot, const float* yDot,
+        const Simd::NodeForceParams& params, std::size_t count
+    ) {
+        nodeForcesScalar(xDotDiff, yDotDiff, xDot, yDot, params, 0, count);
+    }
+
+    struct KernelSet
+    {
+        const char* name;
+        decltype(&axpyScalar) axpy;
+        decltype(&rk4CombineScalar) rk4Combine;
+        decltype(&nodeForcesScalarAll) nodeForces;
+    };
+
+    constexpr KernelSet scalarKernels { "scalar", axpyScalar, rk4CombineScalar, nodeForcesScalarAll };
+
+#ifdef SIMD_KERNELS_X86
+    constexpr KernelSet sseKernels { "sse", axpySse, rk4CombineSse, nodeForcesSse };
+    constexpr KernelSet avx2Kernels { "avx2", axpyAvx2, rk4CombineAvx2, nodeForcesAvx2 };
+#endif
+
+    KernelSet selectKernels()
+    {
+        auto variable { std::getenv("SOFTBODY_KERNELS") };
+        std::string_view requested { variable ? variable : "" };
+        if (requested == "scalar")
+            return scalarKernels;
+        if (!requested.empty() && requested != "sse" && requested != "avx2")
+            std::cerr << "Unknown SOFTBODY_KERNELS value " << requested << ", expected scalar, sse or avx2" << std::endl;
+
+#ifdef SIMD_KERNELS_X86
+        __builtin_cpu_init();
+        bool hasAvx2 { __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") };
+        bool hasSse { __builtin_cpu_supports("sse2") != 0 };
+
+        if (requested == "avx2" && !hasAvx2)
+            std::cerr << "SOFTBODY_KERNELS=avx2 but the CPU lacks AVX2 or FMA" << std::endl;
+        if (requested == "sse" && !hasSse)
+            std::cerr << "SOFTBODY_KERNELS=sse but the CPU lacks SSE2" << std::endl;
+
+        if (requested == "sse" && hasSse)
+            return sseKernels;
+        if (hasAvx2)
+            return avx2Kernels;
+        if (hasSse)
+            return sseKernels;
+#else
+        if (requested == "sse" || requested == "avx2")
+            std::cerr << "SOFTBODY_KERNELS=" << requested << " needs an x86 build" << std::endl;
+#endif
+
+        return scalarKernels;
+    }
+
+    const KernelSet& kernels()
+    {
+        static const KernelSet selected { [] {
+            auto set { selectKernels() };
+            std::cout << "Simulation kernels: " << set.name << std::endl;
+            return set;
+        }() };
+        return selected;
+    }
+}
+
+void Simd::axpy(float* out, const float* a, float scale, const float* b, std::size_t count)
+{
+    kernels().axpy(out, a, scale, b, count);
+}
+
+void Simd::rk4Combine(
+    float* values,
+    const float* k1, const float* k2, const float* k3, const float* k4,
+    float scale, std::size_t count
+) {
+    kernels().rk4Combine(values, k1, k2, k3, k4, scale, count);
+}
+
+void Simd::nodeForces(
+    float* xDotDiff, float* yDotDiff,
+    const float* xDot, const float* yDot,
+    const NodeForceParams& params, std::size_t count
+) {
+    kernels().nodeForces(xDotDiff, yDotDiff, xDot, yDot, params, count);
+}
@@ -0,0 +1,49 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include "aligned_allocator.hpp"
+
+#include <cstddef>
+
+// Vectorized loops over structure-of-arrays simulation buffers. The
+// implementation (AVX2, SSE or scalar) is picked once at runtime from the
+// CPU features; setting SOFTBODY_KERNELS=scalar|sse|avx2 overrides it.
+namespace Simd
+{
+    constexpr std::size_t alignment { 32 };
+    constexpr std::size_t laneWidth { 8 };
+
+    using AlignedFloats = AlignedVector<float, alignment>;
+
+    // Rounds a count up to a whole number of SIMD lanes
+    constexpr std::size_t padded(std::size_t count)
+    {
+        return (count + laneWidth - 1) / laneWidth * laneWidth;
+    }
+
+    struct NodeForceParams
+    {
+        float airResistance{};
+        bool gravity{};
+        float gravityStrength{};
+    };
+
+    // out[i] = a[i] + scale * b[i]
+    void axpy(float* out, const float* a, float scale, const float* b, std::size_t count);
+
+    // values[i] += scale * (k1[i] + 2 k2[i] + 2 k3[i] + k4[i])
+    void rk4Combine(
+        float* values,
+        const float* k1, const float* k2, const float* k3, const float* k4,
+        float scale, std::size_t count
+    );
+
+    // Per-node accelerations: air resistance and gravity
+    void nodeForces(
+        float* xDotDiff, float* yDotDiff,
+        const float* xDot, const float* yDot,
+        const NodeForceParams& params, std::size_t count
+    );
+}
+
+#endif // SIMD_KERNELS_HPP
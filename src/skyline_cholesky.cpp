@@ -0,0 +1,147 @@
+#include "skyline_cholesky.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+void SkylineCholesky::order(int size, std::vector<Entry> const& entries)
+{
+    std::vector<std::vector<int>> neighbors(size);
+    for (auto const& entry : entries) {
+        if (entry.row != entry.column) {
+            neighbors[entry.row].push_back(entry.column);
+            neighbors[entry.column].push_back(entry.row);
+        }
+    }
+
+    for (auto& list : neighbors) {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+
+    auto degree = [&](int node) { return neighbors[node].size(); };
+
+    std::vector<int> nodes(size);
+    for (int i = 0; i < size; i++)
+        nodes[i] = i;
+    std::stable_sort(nodes.begin(), nodes.end(), [&](int a, int b) { return degree(a) < degree(b); });
+
+    // Cuthill-McKee: breadth-first from a low-degree node of each connected
+    // component, visiting neighbors by increasing degree
+    std::vector<bool> visited(size, false);
+    std::vector<int> sequence{};
+    sequence.reserve(size);
+
+    for (auto start : nodes) {
+        if (visited[start])
+            continue;
+
+        std::queue<int> queue{};
+        queue.push(start);
+        visited[start] = true;
+
+        while (!queue.empty()) {
+            auto node { queue.front() };
+            queue.pop();
+            sequence.push_back(node);
+
+            auto next { neighbors[node] };
+            std::stable_sort(next.begin(), next.end(), [&](int a, int b) { return degree(a) < degree(b); });
+            for (auto neighbor : next) {
+                if (!visited[neighbor]) {
+                    visited[neighbor] = true;
+                    queue.push(neighbor);
+                }
+            }
+        }
+    }
+
+    permutation.assign(sequence.rbegin(), sequence.rend());
+    inverse.assign(size, 0);
+    for (int i = 0; i < size; i++)
+        inverse[permutation[i]] = i;
+}
+
+bool SkylineCholesky::factor(int size, std::vector<Entry> const& entries)
+{
+    order(size, entries);
+
+    firstColumn.resize(size);
+    for (int i = 0; i < size; i++)
+        firstColumn[i] = i;
+    for (auto const& entry : entries) {
+        auto row { std::max(inverse[entry.row], inverse[entry.column]) };
+        auto column { std::min(inverse[entry.row], inverse[entry.column]) };
+        firstColumn[row] = std::min(firstColumn[row], column);
+    }
+
+    rowOffsets.resize(size + 1);
+    rowOffsets[0] = 0;
+    for (int i = 0; i < size; i++)
+        rowOffsets[i + 1] = rowOffsets[i] + (i - firstColumn[i] + 1);
+
+    factors.assign(rowOffsets[size], 0.0);
+    auto at = [&](int row, int column) -> double& {
+        return factors[rowOffsets[row] + (column - firstColumn[row])];
+    };
+
+    for (auto const& entry : entries) {
+        auto row { std::max(inverse[entry.row], inverse[entry.column]) };
+        auto column { std::min(inverse[entry.row], inverse[entry.column]) };
+        at(row, column) += entry.value;
+    }
+
+    // Row by row: L_ij = (A_ij - sum_k L_ik L_jk) / L_jj over the columns
+    // both rows have in their envelope
+    for (int i = 0; i < size; i++) {
+        for (int j = firstColumn[i]; j <= i; j++) {
+            auto sum { at(i, j) };
+            for (int k = std::max(firstColumn[i], firstColumn[j]); k < j; k++)
+                sum -= at(i, k) * at(j, k);
+
+            if (j < i) {
+                at(i, j) = sum / at(j, j);
+            } else {
+                if (sum <= 0.0) {
+                    permutation.clear();
+                    inverse.clear();
+                    factors.clear();
+                    return false;
+                }
+                at(i, i) = std::sqrt(sum);
+            }
+        }
+    }
+
+    return true;
+}
+
+void SkylineCholesky::solve(float* values, std::vector<double>& work) const
+{
+    auto n { size() };
+    work.resize(n);
+    for (int i = 0; i < n; i++)
+        work[i] = values[permutation[i]];
+
+    auto at = [&](int row, int column) {
+        return factors[rowOffsets[row] + (column - firstColumn[row])];
+    };
+
+    // L y = b
+    for (int i = 0; i < n; i++) {
+        auto sum { work[i] };
+        for (int k = firstColumn[i]; k < i; k++)
+            sum -= at(i, k) * work[k];
+        work[i] = sum / at(i, i);
+    }
+
+    // L^T x = y, column by column so the rows are read contiguously
+    for (int i = n - 1; i >= 0; i--) {
+        work[i] /= at(i, i);
+        for (int k = firstColumn[i]; k < i; k++)
+            work[k] -= at(i, k) * work[i];
+    }
+
+    for (int i = 0; i < n; i++)
+        values[permutation[i]] = static_cast<float>(work[i]);
+}
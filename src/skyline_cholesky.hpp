@@ -0,0 +1,45 @@
+#ifndef SKYLINE_CHOLESKY_HPP
+#define SKYLINE_CHOLESKY_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Cholesky factorization of a sparse symmetric positive definite matrix in
+// skyline (envelope) storage. The unknowns are renumbered with reverse
+// Cuthill-McKee first, which keeps the envelope of a mesh Laplacian narrow,
+// so a factorization is done once and each solve is two cheap sweeps.
+class SkylineCholesky
+{
+public:
+    struct Entry
+    {
+        int row{};
+        int column{};
+        double value{};
+    };
+
+    // Entries may be given for either triangle and may repeat; they are
+    // summed into the lower triangle. Returns false if the matrix is not
+    // positive definite, leaving the factorization empty.
+    bool factor(int size, std::vector<Entry> const& entries);
+
+    // Solves A x = b in place. work must not be shared between threads.
+    void solve(float* values, std::vector<double>& work) const;
+
+    int size() const { return static_cast<int>(permutation.size()); }
+    bool empty() const { return permutation.empty(); }
+
+private:
+    void order(int size, std::vector<Entry> const& entries);
+
+    // permutation[new] = old, inverse[old] = new
+    std::vector<int> permutation{};
+    std::vector<int> inverse{};
+
+    // Row i holds columns firstColumn[i] .. i, starting at rowOffsets[i]
+    std::vector<int> firstColumn{};
+    std::vector<std::size_t> rowOffsets{};
+    std::vector<double> factors{};
+};
+
+#endif // SKYLINE_CHOLESKY_HPP
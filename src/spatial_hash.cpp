@@ -0,0 +1,68 @@
+#include "spatial_hash.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+std::size_t SpatialHash::bucketOf(int cellX, int cellY) const
+{
+    auto hash { static_cast<std::size_t>(cellX) * 73856093u ^ static_cast<std::size_t>(cellY) * 19349663u };
+    return hash & bucketMask;
+}
+
+template<typename Visit>
+void SpatialHash::forEachBucket(Box const& box, Visit&& visit)
+{
+    // A box at a non-finite position overlaps nothing
+    if (!std::isfinite(box.min.x) || !std::isfinite(box.min.y) || !std::isfinite(box.max.x) || !std::isfinite(box.max.y))
+        return;
+
+    auto minX { cellOf(box.min.x) };
+    auto minY { cellOf(box.min.y) };
+    auto maxX { cellOf(box.max.x) };
+    auto maxY { cellOf(box.max.y) };
+    if (maxX < minX || maxY < minY)
+        return;
+
+    // A box spanning at least as many cells as there are buckets is simply
+    // stored in all of them
+    auto cells { (static_cast<long long>(maxX) - minX + 1) * (static_cast<long long>(maxY) - minY + 1) };
+    if (cells > static_cast<long long>(bucketMask)) {
+        for (std::size_t bucket = 0; bucket <= bucketMask; bucket++)
+            visit(bucket);
+        return;
+    }
+
+    boxBuckets.clear();
+    for (auto cellY { minY }; cellY <= maxY; cellY++) {
+        for (auto cellX { minX }; cellX <= maxX; cellX++)
+            boxBuckets.push_back(bucketOf(cellX, cellY));
+    }
+
+    std::sort(boxBuckets.begin(), boxBuckets.end());
+    boxBuckets.erase(std::unique(boxBuckets.begin(), boxBuckets.end()), boxBuckets.end());
+    for (auto bucket : boxBuckets)
+        visit(bucket);
+}
+
+void SpatialHash::build(float cellSize, std::vector<Box> const& boxes)
+{
+    inverseCellSize = 1.f / cellSize;
+
+    // At least twice as many buckets as boxes keeps collisions rare
+    std::size_t bucketCount { 64 };
+    while (bucketCount < 2 * boxes.size())
+        bucketCount *= 2;
+    bucketMask = bucketCount - 1;
+
+    bucketStart.assign(bucketCount + 1, 0);
+    for (auto const& box : boxes)
+        forEachBucket(box, [&](std::size_t bucket) { bucketStart[bucket + 1]++; });
+
+    for (std::size_t b = 0; b < bucketCount; b++)
+        bucketStart[b + 1] += bucketStart[b];
+
+    entries.resize(bucketStart[bucketCount]);
+    fill.assign(bucketStart.begin(), bucketStart.end() - 1);
+    for (int item = 0; item < static_cast<int>(boxes.size()); item++)
+        forEachBucket(boxes[item], [&](std::size_t bucket) { entries[fill[bucket]++] = item; });
+}
@@ -0,0 +1,66 @@
+#ifndef SPATIAL_HASH_HPP
+#define SPATIAL_HASH_HPP
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Uniform grid over the plane, hashed into a fixed table so that only
+// occupied cells cost memory. Items are boxes, stored in every cell they
+// overlap; a build is two counting passes over the boxes into reused
+// arrays, with no per-cell allocations.
+class SpatialHash
+{
+public:
+    struct Box
+    {
+        sf::Vector2f min{};
+        sf::Vector2f max{};
+    };
+
+    // Cells should be at least as large as a typical box, so each box
+    // lands in a handful of cells
+    void build(float cellSize, std::vector<Box> const& boxes);
+
+    // Calls visit(item) for every box stored in the cell containing point.
+    // Cells sharing a bucket are not told apart, so callers test overlap.
+    template<typename Visit>
+    void query(sf::Vector2f point, Visit&& visit) const
+    {
+        if (bucketStart.empty() || !std::isfinite(point.x) || !std::isfinite(point.y))
+            return;
+
+        auto bucket { bucketOf(cellOf(point.x), cellOf(point.y)) };
+        for (auto k { bucketStart[bucket] }; k < bucketStart[bucket + 1]; k++)
+            visit(entries[k]);
+    }
+
+private:
+    // Clamped so that far-off coordinates still cast to a valid int
+    int cellOf(float coordinate) const
+    {
+        return static_cast<int>(std::clamp(std::floor(coordinate * inverseCellSize), -cellLimit, cellLimit));
+    }
+
+    std::size_t bucketOf(int cellX, int cellY) const;
+
+    // Calls visit(bucket) once for each distinct bucket a box overlaps
+    template<typename Visit>
+    void forEachBucket(Box const& box, Visit&& visit);
+
+    static constexpr float cellLimit { 1e9f };
+
+    float inverseCellSize{ 1.f };
+    std::size_t bucketMask{ 0 };
+
+    // Items of bucket b are entries[bucketStart[b]] .. entries[bucketStart[b + 1] - 1]
+    std::vector<int> bucketStart{};
+    std::vector<int> entries{};
+    std::vector<int> fill{};
+    std::vector<std::size_t> boxBuckets{};
+};
+
+#endif // SPATIAL_HASH_HPP
@@ -0,0 +1,45 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-capacity lock-free ring buffer for one producer and one consumer
+// thread. push fails when the queue is full, pop when it is empty.
+template<typename T, std::size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(const T& item)
+    {
+        auto tail { tailIndex.load(std::memory_order_relaxed) };
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[tail & (Capacity - 1)] = item;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        auto head { headIndex.load(std::memory_order_relaxed) };
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+
+        item = items[head & (Capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<std::size_t> headIndex { 0 };
+    alignas(64) std::atomic<std::size_t> tailIndex { 0 };
+
+    std::array<T, Capacity> items{};
+};
+
+#endif // SPSC_QUEUE_HPP
@@ -0,0 +1,107 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static void relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+unsigned ThreadPool::defaultThreadCount()
+{
+    if (auto requested { std::getenv("SOFTBODY_THREADS") })
+        return static_cast<unsigned>(std::max(1, std::atoi(requested)));
+
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    for (unsigned i = 1; i < std::max(1u, threadCount); i++)
+        workers.emplace_back([this, i]() { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock { mutex };
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::run(std::size_t count, std::size_t minChunk, Trampoline trampoline, void* context)
+{
+    if (count == 0)
+        return;
+
+    auto participants { static_cast<unsigned>(std::clamp<std::size_t>(
+        count / std::max<std::size_t>(minChunk, 1), 1, threadCount()
+    )) };
+
+    if (participants == 1) {
+        trampoline(context, 0, count);
+        return;
+    }
+
+    job = trampoline;
+    jobContext = context;
+    jobCount = count;
+    jobParticipants = participants;
+    pending = static_cast<unsigned>(workers.size());
+
+    {
+        std::lock_guard lock { mutex };
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunk(0);
+
+    while (pending.load(std::memory_order_acquire) != 0)
+        relax();
+}
+
+void ThreadPool::runChunk(unsigned participant)
+{
+    if (participant >= jobParticipants)
+        return;
+
+    auto begin { jobCount * participant / jobParticipants };
+    auto end { jobCount * (participant + 1) / jobParticipants };
+    job(jobContext, begin, end);
+}
+
+void ThreadPool::workerLoop(unsigned participant)
+{
+    std::uint64_t seen { 0 };
+
+    while (true) {
+        for (int spin = 0; spin < spinIterations && generation.load() == seen && !stopping; spin++)
+            relax();
+
+        if (generation.load() == seen) {
+            std::unique_lock lock { mutex };
+            wake.wait(lock, [&]() { return generation.load() != seen || stopping; });
+        }
+
+        if (stopping)
+            return;
+
+        seen = generation.load();
+        runChunk(participant);
+        pending.fetch_sub(1, std::memory_order_release);
+    }
+}
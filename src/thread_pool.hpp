@@ -0,0 +1,65 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent workers for fork-join loops. parallelFor splits a range into
+// one contiguous chunk per participating thread (the caller included) and
+// returns once every chunk is done. Workers spin briefly between jobs, so
+// back-to-back calls from the same frame do not pay a full wake-up.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = defaultThreadCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned threadCount() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // Hardware concurrency, unless overridden by SOFTBODY_THREADS
+    static unsigned defaultThreadCount();
+
+    // Calls task(begin, end) over [0, count). Ranges smaller than
+    // minChunk per thread use fewer threads, down to running inline.
+    template<typename Task>
+    void parallelFor(std::size_t count, std::size_t minChunk, Task&& task)
+    {
+        using TaskType = std::remove_reference_t<Task>;
+        run(count, minChunk, [](void* context, std::size_t begin, std::size_t end) {
+            (*static_cast<TaskType*>(context))(begin, end);
+        }, &task);
+    }
+
+private:
+    using Trampoline = void (*)(void* context, std::size_t begin, std::size_t end);
+
+    void run(std::size_t count, std::size_t minChunk, Trampoline trampoline, void* context);
+    void runChunk(unsigned participant);
+    void workerLoop(unsigned participant);
+
+    std::vector<std::thread> workers{};
+
+    std::mutex mutex{};
+    std::condition_variable wake{};
+    std::atomic<std::uint64_t> generation{ 0 };
+    std::atomic<unsigned> pending{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    Trampoline job{};
+    void* jobContext{};
+    std::size_t jobCount{};
+    unsigned jobParticipants{};
+
+    static constexpr int spinIterations { 4000 };
+};
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,47 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer, single-consumer handoff of the latest value.
+// The producer fills writeBuffer() and publishes it; the consumer picks up
+// the most recent published buffer with update(). Neither side ever waits,
+// and values published in between are simply skipped.
+template<typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    T& writeBuffer() { return buffers[writeIndex]; }
+
+    void publish()
+    {
+        writeIndex = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Consumer side; returns whether a newer buffer was picked up
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit))
+            return false;
+
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[readIndex]; }
+
+private:
+    static constexpr std::uint8_t indexMask { 0b011 };
+    static constexpr std::uint8_t freshBit { 0b100 };
+
+    std::array<T, 3> buffers{};
+
+    std::uint8_t writeIndex { 0 };
+    std::atomic<std::uint8_t> middle { 1 };
+    std::uint8_t readIndex { 2 };
+};
+
+#endif // TRIPLE_BUFFER_HPP
@@ -0,0 +1,141 @@
+#include "mesh_force_system.hpp"
+
+#include "simd_kernels.hpp"
+#include "utilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Extended position-based dynamics (Macklin et al.): edges are distance
+// constraints and triangles keep their signed area. Each constraint's
+// compliance is the inverse of the stiffness the force model gives it, and
+// the spring damping becomes the matching XPBD damping term, so both
+// backends describe the same material. The step is split into substeps
+// with one Gauss-Seidel pass each, which converges better than iterating
+// once per frame.
+
+void MeshForceSystem::SystemState::stepXpbd(Workspace& workspace, float h)
+{
+    auto const& system { forceSystem.get() };
+    auto const& springs { system.springs };
+    auto const& triangles { system.triangles };
+    auto& external { workspace.k1 };
+    auto& previous { workspace.scratch };
+    auto& lambdas { workspace.constraintLambdas };
+    auto half { stride * 2 };
+    auto sub { h / constraintSubsteps };
+
+    Simd::NodeForceParams nodeParams {
+        airResistance,
+        system.gravity,
+        gravityStrength
+    };
+
+    auto inverseMass = [&](int node) {
+        return system.fixedMask[node] ? 0.f : 1.f;
+    };
+
+    lambdas.resize(springs.size() + triangles.size());
+
+    for (int substep = 0; substep < constraintSubsteps; substep++) {
+        // Air resistance and gravity act as external accelerations
+        Simd::nodeForces(external.xDots(), external.yDots(), xDots(), yDots(), nodeParams, count);
+        for (auto i : system.fixedNodes)
+            external.xDot(i) = external.yDot(i) = 0.f;
+
+        Simd::axpy(velocities(), velocities(), sub, external.velocities(), half);
+        std::copy_n(positions(), half, previous.positions());
+        Simd::axpy(positions(), positions(), sub, velocities(), half);
+
+        std::fill(lambdas.begin(), lambdas.end(), 0.f);
+
+        for (std::size_t k = 0; k < springs.size(); k++) {
+            auto const& spring { springs[k] };
+            auto wa { inverseMass(spring.a) };
+            auto wb { inverseMass(spring.b) };
+
+            sf::Vector2f delta { x(spring.a) - x(spring.b), y(spring.a) - y(spring.b) };
+            auto length { std::sqrt(delta.x * delta.x + delta.y * delta.y) };
+            if (length < 1e-6f)
+                continue;
+
+            auto n { delta / length };
+            auto stiffness { springConstant * spring.stiffnessScale };
+            auto compliance { 1.f / (stiffness * sub * sub) };
+            auto gamma { dampingConstant * spring.stiffnessScale / (stiffness * sub) };
+
+            sf::Vector2f moved {
+                x(spring.a) - previous.x(spring.a) - x(spring.b) + previous.x(spring.b),
+                y(spring.a) - previous.y(spring.a) - y(spring.b) + previous.y(spring.b)
+            };
+
+            auto constraint { length - spring.restLength };
+            auto deltaLambda { (-constraint - compliance * lambdas[k] - gamma * (n.x * moved.x + n.y * moved.y))
+                / ((1.f + gamma) * (wa + wb) + compliance) };
+            lambdas[k] += deltaLambda;
+
+            x(spring.a) += wa * deltaLambda * n.x;
+            y(spring.a) += wa * deltaLambda * n.y;
+            x(spring.b) -= wb * deltaLambda * n.x;
+            y(spring.b) -= wb * deltaLambda * n.y;
+        }
+
+        auto areaCompliance { 1.f / (areaSpringConstant * sub * sub) };
+
+        for (std::size_t k = 0; k < triangles.size(); k++) {
+            auto const& tri { triangles[k] };
+            int nodes[3] { tri.a, tri.b, tri.c };
+            sf::Vector2f gradients[3] {
+                0.5f * sf::Vector2f{y(tri.b) - y(tri.c), x(tri.c) - x(tri.b)},
+                0.5f * sf::Vector2f{y(tri.c) - y(tri.a), x(tri.a) - x(tri.c)},
+                0.5f * sf::Vector2f{y(tri.a) - y(tri.b), x(tri.b) - x(tri.a)}
+            };
+
+            float weight { 0.f };
+            for (int j = 0; j < 3; j++)
+                weight += inverseMass(nodes[j]) * (gradients[j].x * gradients[j].x + gradients[j].y * gradients[j].y);
+            if (weight + areaCompliance <= 0.f)
+                continue;
+
+            auto constraint { Util::signedArea(
+                {x(tri.a), y(tri.a)},
+                {x(tri.b), y(tri.b)},
+                {x(tri.c), y(tri.c)}
+            ) - tri.restSignedArea };
+
+            auto& lambda { lambdas[springs.size() + k] };
+            auto deltaLambda { (-constraint - areaCompliance * lambda) / (weight + areaCompliance) };
+            lambda += deltaLambda;
+
+            for (int j = 0; j < 3; j++) {
+                x(nodes[j]) += inverseMass(nodes[j]) * deltaLambda * gradients[j].x;
+                y(nodes[j]) += inverseMass(nodes[j]) * deltaLambda * gradients[j].y;
+            }
+        }
+
+        // The mouse is a zero-length spring to a point of infinite mass
+        if (system.dragging && system.draggedNode != -1 && !system.fixedMask[system.draggedNode]) {
+            auto node { system.draggedNode };
+            sf::Vector2f delta { x(node) - system.mousePos.x, y(node) - system.mousePos.y };
+            auto length { std::sqrt(delta.x * delta.x + delta.y * delta.y) };
+
+            if (length > 1e-6f) {
+                auto n { delta / length };
+                auto stiffness { springConstant * 2 };
+                auto compliance { 1.f / (stiffness * sub * sub) };
+                auto gamma { dampingConstant / (stiffness * sub) };
+                sf::Vector2f moved { x(node) - previous.x(node), y(node) - previous.y(node) };
+
+                auto deltaLambda { (-length - gamma * (n.x * moved.x + n.y * moved.y))
+                    / ((1.f + gamma) + compliance) };
+
+                x(node) += deltaLambda * n.x;
+                y(node) += deltaLambda * n.y;
+            }
+        }
+
+        // Velocities are whatever moved the nodes to where they ended up
+        for (std::size_t i = 0; i < half; i++)
+            velocities()[i] = (positions()[i] - previous.positions()[i]) / sub;
+    }
+}